@@ -0,0 +1,261 @@
+/*===========================================================================*/
+/* EnviTools - reading and writing of ENVI binary data cubes                 */
+/* Copyright (C) 2005 Jarek Tuszynski                                        */
+/* Distributed under GNU General Public License version 3                    */
+/*===========================================================================*/
+/*                                                                           */
+/* This file contains interface between EnviTools.cpp and caTools R Package  */
+/*===========================================================================*/
+
+#include "EnviTools.h"
+extern "C" {
+
+  // running window kernels from runfunc.c
+  void runmean(double *In, double *Out, const int *nIn, const int *nWin);
+  void runmin (double *In, double *Out, const int *nIn, const int *nWin);
+  void runmax (double *In, double *Out, const int *nIn, const int *nWin);
+
+  //------------------------------------------------------------------
+  // Memory mapped ENVI cube kept in an external pointer
+  //------------------------------------------------------------------
+
+  static void envifinalize(SEXP Ptr)
+  {
+    EnviCube* cube = (EnviCube*) R_ExternalPtrAddr(Ptr);
+    if (cube) {
+      EnviClose(cube);
+      R_Free(cube);
+    }
+    R_ClearExternalPtr(Ptr);
+  }
+
+  SEXP enviopen(SEXP filename, SEXP Param)
+  { // Param: nRow, nCol, nBand, data type, header offset, interleave, swap
+    const double *param = REAL(Param);
+    EnviCube* cube = R_Calloc(1, EnviCube);
+    SEXP Ptr;
+    cube->nRow       = (int) param[0];
+    cube->nCol       = (int) param[1];
+    cube->nBand      = (int) param[2];
+    cube->DataType   = (int) param[3];
+    cube->Offset     = (long long) param[4];
+    cube->Interleave = (int) param[5];
+    cube->Swap       = (param[6]!=0);
+    int stats = EnviOpen(CHAR(STRING_ELT(filename, 0)), cube);
+    if (stats) {
+      R_Free(cube);
+      if (stats==2) Error("read.ENVI: Binary file is shorter than its header claims");
+      if (stats==3) Error("read.ENVI: Unsupported data type");
+      Error("read.ENVI: Could not open or map input file");
+    }
+    PROTECT(Ptr = R_MakeExternalPtr(cube, Rf_install("EnviCube"), R_NilValue));
+    R_RegisterCFinalizerEx(Ptr, envifinalize, TRUE);
+    UNPROTECT(1);
+    return Ptr;
+  }
+
+  static int* enviindex(SEXP Index, int n, const char *name)
+  { // 1-based R indices -> 0-based C indices
+    int i, m = Rf_length(Index), *in = INTEGER(Index);
+    int *out = (int*) R_alloc(m, sizeof(int));
+    for (i=0; i<m; i++) {
+      if (in[i]<1 || in[i]>n) Error("envi.read: '%s' index out of bounds", name);
+      out[i] = in[i]-1;
+    }
+    return out;
+  }
+
+  SEXP envihdr(SEXP filename)
+  { // returns named list of header fields, each a character vector
+    EnviHeader hdr = {0, 0, NULL};
+    if (EnviReadHeader(CHAR(STRING_ELT(filename, 0)), &hdr))
+      Error("read.ENVI: Could not open header file");
+    SEXP Ret, Names, Item;
+    PROTECT(Ret   = Rf_allocVector(VECSXP, hdr.nField));
+    PROTECT(Names = Rf_allocVector(STRSXP, hdr.nField));
+    for (int i=0; i<hdr.nField; i++) {
+      EnviField *f = hdr.Field+i;
+      SET_STRING_ELT(Names, i, Rf_mkChar(f->Key));
+      Item = Rf_allocVector(STRSXP, f->nItem);
+      SET_VECTOR_ELT(Ret, i, Item);
+      for (int j=0; j<f->nItem; j++) SET_STRING_ELT(Item, j, Rf_mkChar(f->Item[j]));
+    }
+    Rf_setAttrib(Ret, R_NamesSymbol, Names);
+    EnviFreeHeader(&hdr);
+    UNPROTECT(2);
+    return Ret;
+  }
+
+  static SEXP envialloc(const EnviCube *cube, int nr, int nc, int nb, bool packed,
+                        bool real, void **out)
+  { // allocate [row, col, band] array for the region, as EnviExtract fills it
+    // or as doubles if 'real'. Returned object is protected
+    int size = EnviTypeSize(cube->DataType);
+    SEXPTYPE type;
+    switch (cube->DataType) {
+      case ENVI_FLOAT:
+      case ENVI_DOUBLE:
+      case ENVI_UINT32:
+      case ENVI_INT64:
+      case ENVI_UINT64:  type = REALSXP; break;
+      case ENVI_CFLOAT:
+      case ENVI_COMPLEX: type = CPLXSXP; break;
+      default:           type = INTSXP;
+    }
+    if (real) { type = REALSXP; packed = false; }
+    SEXP Ret, Dim;
+    if (packed && size==1) { // raw [row, col, band] array
+      PROTECT(Ret = Rf_alloc3DArray(RAWSXP, nr, nc, nb));
+      *out = RAW(Ret);
+    } else if (packed) {     // 16 bit values as raw [byte, row, col, band] array
+      PROTECT(Ret = Rf_allocVector(RAWSXP, 2*(R_xlen_t)nr*nc*nb));
+      PROTECT(Dim = Rf_allocVector(INTSXP, 4));
+      INTEGER(Dim)[0] = 2;
+      INTEGER(Dim)[1] = nr;
+      INTEGER(Dim)[2] = nc;
+      INTEGER(Dim)[3] = nb;
+      Rf_setAttrib(Ret, R_DimSymbol, Dim);
+      UNPROTECT(1);
+      *out = RAW(Ret);
+    } else {
+      PROTECT(Ret = Rf_alloc3DArray(type, nr, nc, nb));
+      *out = (type==INTSXP ? (void*) INTEGER(Ret) :
+             (type==REALSXP ? (void*) REAL(Ret) : (void*) COMPLEX(Ret)));
+    }
+    return Ret;
+  }
+
+  SEXP enviread(SEXP Ptr, SEXP Rows, SEXP Cols, SEXP Bands, SEXP Packed)
+  { // returns cube[Rows, Cols, Bands] as [row, col, band] array
+    EnviCube* cube = (EnviCube*) R_ExternalPtrAddr(Ptr);
+    if (!cube) Error("envi.read: ENVI file was already closed");
+    int nr = Rf_length(Rows), nc = Rf_length(Cols), nb = Rf_length(Bands);
+    int *rows  = enviindex(Rows,  cube->nRow,  "rows");
+    int *cols  = enviindex(Cols,  cube->nCol,  "cols");
+    int *bands = enviindex(Bands, cube->nBand, "bands");
+    bool packed = Rf_asLogical(Packed)==TRUE && EnviTypeSize(cube->DataType)<=2;
+    void *out;
+    SEXP Ret = envialloc(cube, nr, nc, nb, packed, false, &out);
+    EnviExtract(cube, rows, nr, cols, nc, bands, nb, out, packed);
+    UNPROTECT(1);
+    return Ret;
+  }
+
+  //------------------------------------------------------------------
+  // Stream of tiles kept in an external pointer. The tile being read in
+  // the background is kept in the pointer's protected list.
+  //------------------------------------------------------------------
+
+  static void envitilesfinalize(SEXP Ptr)
+  {
+    EnviStream* s = (EnviStream*) R_ExternalPtrAddr(Ptr);
+    if (s) {
+      EnviStreamClose(s);
+      R_Free(s);
+    }
+    R_ClearExternalPtr(Ptr);
+  }
+
+  SEXP envitiles(SEXP Ptr, SEXP filename, SEXP Param)
+  { // Param: rows per tile, bands per tile, packed, kernel (0 - none, 1 - mean,
+    // 2 - min, 3 - max), window size
+    EnviCube* cube = (EnviCube*) R_ExternalPtrAddr(Ptr);
+    if (!cube) Error("envi.tiles: ENVI file was already closed");
+    const int *param = INTEGER(Param);
+    const EnviKernel kernel[4] = {NULL, runmean, runmin, runmax};
+    if (param[0]<1 || param[1]<1 || param[3]<0 || param[3]>3 || param[4]<1)
+      Error("envi.tiles: Incorrect tile size or window");
+    if (param[3] && (cube->DataType==ENVI_CFLOAT || cube->DataType==ENVI_COMPLEX))
+      Error("envi.tiles: Running window functions need real data");
+    EnviStream* s = R_Calloc(1, EnviStream);
+    SEXP Ret, Prot;
+    s->Cube      = *cube;
+    s->nTileRow  = param[0];
+    s->nTileBand = param[1];
+    s->Packed    = (param[2]!=0 && param[3]==0 && EnviTypeSize(cube->DataType)<=2);
+    s->Kernel    = kernel[param[3]];
+    s->nWin      = param[4];
+    if (EnviStreamOpen(CHAR(STRING_ELT(filename, 0)), s)) {
+      R_Free(s);
+      Error("envi.tiles: Could not open or map input file");
+    }
+    PROTECT(Prot = Rf_allocVector(VECSXP, 1));
+    PROTECT(Ret  = R_MakeExternalPtr(s, Rf_install("EnviStream"), Prot));
+    R_RegisterCFinalizerEx(Ret, envitilesfinalize, TRUE);
+    UNPROTECT(2);
+    return Ret;
+  }
+
+  static SEXP envitile(EnviStream *s, int tile, void **out)
+  { // allocate array for the tile, returned object is protected
+    int row, nr, band, nb;
+    EnviTileRange(s, tile, &row, &nr, &band, &nb);
+    return envialloc(&s->Cube, nr, s->Cube.nCol, nb, s->Packed, s->Kernel!=NULL, out);
+  }
+
+  SEXP envinext(SEXP Ptr)
+  { // returns the next tile with "rows" and "bands" attributes, or NULL at the end
+    EnviStream* s = (EnviStream*) R_ExternalPtrAddr(Ptr);
+    if (!s) Error("envi.next: ENVI file was already closed");
+    if (s->iTile >= s->nTile) return R_NilValue;
+    SEXP Prot = R_ExternalPtrProtected(Ptr), Ret, Next, Idx;
+    void *out;
+    int i, row, nr, band, nb, tile = s->iTile;
+    if (s->Thread) {            // tile is already being read
+      EnviWait(s);
+      PROTECT(Ret = VECTOR_ELT(Prot, 0));
+    } else {                    // first tile
+      Ret = envitile(s, tile, &out);
+      EnviReadTile(s, tile, out);
+    }
+    SET_VECTOR_ELT(Prot, 0, R_NilValue);
+    if (tile+1 < s->nTile) {    // start reading the next one
+      Next = envitile(s, tile+1, &out);
+      SET_VECTOR_ELT(Prot, 0, Next);
+      UNPROTECT(1);
+      EnviPrefetch(s, tile+1, out);
+    }
+    s->iTile++;
+    EnviTileRange(s, tile, &row, &nr, &band, &nb);
+    PROTECT(Idx = Rf_allocVector(INTSXP, nr));
+    for (i=0; i<nr; i++) INTEGER(Idx)[i] = row+i+1;
+    Rf_setAttrib(Ret, Rf_install("rows"), Idx);
+    UNPROTECT(1);
+    PROTECT(Idx = Rf_allocVector(INTSXP, nb));
+    for (i=0; i<nb; i++) INTEGER(Idx)[i] = band+i+1;
+    Rf_setAttrib(Ret, Rf_install("bands"), Idx);
+    UNPROTECT(2);
+    return Ret;
+  }
+
+  SEXP envitilesclose(SEXP Ptr)
+  {
+    envitilesfinalize(Ptr);
+    return R_NilValue;
+  }
+
+  SEXP enviwrite(SEXP filename, SEXP X, SEXP Param)
+  { // Param: nRow, nCol, nBand, data type, interleave, swap
+    const int *param = INTEGER(Param);
+    int type = TYPEOF(X);
+    void *data = (type==INTSXP ? (void*) INTEGER(X) :
+                 (type==REALSXP ? (void*) REAL(X) : (void*) COMPLEX(X)));
+    int stats = EnviWrite(CHAR(STRING_ELT(filename, 0)), data, type, param[0],
+                          param[1], param[2], param[3], param[4], param[5]!=0);
+    if (stats==1) Error("write.ENVI: Could not open output file");
+    if (stats==2) Error("write.ENVI: Error while writing output file");
+    if (stats==3) Error("write.ENVI: Data type does not match the data");
+    return R_NilValue;
+  }
+
+  SEXP enviclose(SEXP Ptr)
+  {
+    EnviCube* cube = (EnviCube*) R_ExternalPtrAddr(Ptr);
+    if (cube) {
+      EnviClose(cube);
+      R_Free(cube);
+    }
+    R_ClearExternalPtr(Ptr);
+    return R_NilValue;
+  }
+}
@@ -0,0 +1,614 @@
+/*===========================================================================*/
+/* EnviTools - reading and writing of ENVI binary data cubes                 */
+/* Copyright (C) 2005 Jarek Tuszynski                                        */
+/* Distributed under GNU General Public License version 3                    */
+/*===========================================================================*/
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>   // memcpy
+#include <ctype.h>
+#include <thread>
+#include "EnviTools.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ENVI_SIMD
+#include <immintrin.h>
+#endif
+
+int EnviTypeSize(int DataType)
+{
+  switch (DataType) {
+    case ENVI_UINT8:   return 1;
+    case ENVI_INT16:
+    case ENVI_UINT16:  return 2;
+    case ENVI_INT32:
+    case ENVI_UINT32:
+    case ENVI_FLOAT:   return 4;
+    case ENVI_DOUBLE:
+    case ENVI_INT64:
+    case ENVI_UINT64:
+    case ENVI_CFLOAT:  return 8;
+    case ENVI_COMPLEX: return 16;
+  }
+  return 0;
+}
+
+//==============================================================
+// Header file parser. Grammar:
+//   ENVI                         - first line (optional)
+//   ; comment                    - ignored
+//   key = value                  - value till the end of the line
+//   key = { item, item, ... }    - list of items, can span many lines
+//==============================================================
+
+static char* Trim(char *s)
+{ // remove leading and trailing white space in place
+  while (isspace((uchar) *s)) s++;
+  char *e = s+strlen(s);
+  while (e>s && isspace((uchar) e[-1])) *--e = 0;
+  return s;
+}
+
+static char* NormalizeKey(char *s)
+{ // lower case with single spaces between words
+  char *p, *q;
+  s = Trim(s);
+  for (p=q=s; *p; p++) {
+    if (isspace((uchar) *p)) {
+      if (q[-1]!=' ') *q++ = ' ';
+    } else *q++ = (char) tolower((uchar) *p);
+  }
+  *q = 0;
+  return s;
+}
+
+static void AddField(EnviHeader *hdr, const char *key, char *value, bool list)
+{
+  if (hdr->nField==hdr->nAlloc) {
+    hdr->nAlloc = (hdr->nAlloc ? 2*hdr->nAlloc : 32);
+    hdr->Field  = (EnviField*) realloc(hdr->Field, hdr->nAlloc*sizeof(EnviField));
+  }
+  EnviField *f = hdr->Field + hdr->nField++;
+  int nItem = 1;
+  char *p;
+  value = Trim(value);
+  if (list) for (p=value; *p; p++) if (*p==',') nItem++;
+  if (!*value) nItem = 0;
+  f->Key   = strdup(key);
+  f->nItem = nItem;
+  f->Item  = (char**) malloc((nItem ? nItem : 1)*sizeof(char*));
+  for (int i=0; i<nItem; i++) {
+    p = (list ? strchr(value, ',') : NULL);
+    if (p) *p = 0;
+    f->Item[i] = strdup(Trim(value));
+    if (p) value = p+1;
+  }
+}
+
+int EnviReadHeader(const char *filename, EnviHeader *hdr)
+{
+  memset(hdr, 0, sizeof(EnviHeader));
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) return 1;
+  fseek(fp, 0, SEEK_END);
+  long n = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *text = (char*) malloc(n+1);
+  n = (long) fread(text, 1, n, fp);
+  text[n] = 0;
+  fclose(fp);
+
+  char *p = text, *q, *key, *value;
+  while (*p) {
+    while (isspace((uchar) *p)) p++;
+    if (!*p) break;
+    q = p + strcspn(p, "=\r\n");
+    if (*p==';' || *q!='=') {    // comment or line without '=', like "ENVI"
+      p = q + strcspn(q, "\r\n");
+      continue;
+    }
+    *q  = 0;
+    key = NormalizeKey(p);
+    for (value=q+1; *value==' ' || *value=='\t'; value++);
+    if (*value=='{') {           // list of values: look for closing bracket
+      value++;
+      q = strchr(value, '}');
+      if (!q) q = value+strlen(value);
+      p = (*q ? q+1 : q);
+      *q = 0;
+      AddField(hdr, key, value, strcmp(key, "description")!=0);
+    } else {                     // single value till the end of the line
+      q = value + strcspn(value, "\r\n");
+      p = (*q ? q+1 : q);
+      *q = 0;
+      AddField(hdr, key, value, false);
+    }
+  }
+  free(text);
+  return 0;
+}
+
+void EnviFreeHeader(EnviHeader *hdr)
+{
+  for (int i=0; i<hdr->nField; i++) {
+    EnviField *f = hdr->Field+i;
+    for (int j=0; j<f->nItem; j++) free(f->Item[j]);
+    free(f->Item);
+    free(f->Key);
+  }
+  free(hdr->Field);
+  memset(hdr, 0, sizeof(EnviHeader));
+}
+
+//==============================================================
+// Byte swapping of contiguous runs of numbers: SSSE3 or AVX2
+// byte shuffles chosen at run time, with scalar code for the
+// rest and for other processors
+//==============================================================
+
+#ifdef ENVI_SIMD
+static int SimdLevel()
+{ // 0 - scalar, 1 - SSSE3, 2 - AVX2
+  static int level = -1;
+  if (level<0) {
+    __builtin_cpu_init();
+    level = (__builtin_cpu_supports("avx2") ? 2 : (__builtin_cpu_supports("ssse3") ? 1 : 0));
+  }
+  return level;
+}
+
+__attribute__((target("ssse3")))
+static long SwapCopySSSE3(uchar *dst, const uchar *src, long nByte, int size)
+{
+  char m[16];
+  for (int j=0; j<16; j++) m[j] = (char) ((j/size)*size + size-1 - j%size);
+  const __m128i mask = _mm_loadu_si128((const __m128i*) m);
+  long i=0;
+  for (; i+16<=nByte; i+=16) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (src+i));
+    _mm_storeu_si128((__m128i*) (dst+i), _mm_shuffle_epi8(x, mask));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static long SwapCopyAVX2(uchar *dst, const uchar *src, long nByte, int size)
+{
+  char m[32];
+  for (int j=0; j<32; j++) m[j] = (char) (((j%16)/size)*size + size-1 - j%size);
+  const __m256i mask = _mm256_loadu_si256((const __m256i*) m);
+  long i=0;
+  for (; i+32<=nByte; i+=32) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (src+i));
+    _mm256_storeu_si256((__m256i*) (dst+i), _mm256_shuffle_epi8(x, mask));
+  }
+  return i;
+}
+#endif
+
+static void SwapCopy(uchar *dst, const uchar *src, long n, int size)
+{ // copy n numbers of 'size' bytes (2, 4 or 8) reversing bytes of each
+  long i=0, nByte = n*size;
+#ifdef ENVI_SIMD
+  int level = SimdLevel();
+  if (level==2) i = SwapCopyAVX2(dst, src, nByte, size);
+  if (level>=1) i += SwapCopySSSE3(dst+i, src+i, nByte-i, size);
+#endif
+  for (; i<nByte; i+=size)
+    for (int k=0; k<size; k++) dst[i+k] = src[i+size-1-k];
+}
+
+//==============================================================
+// Memory mapping of the binary file. Pages are read by the OS
+// only when touched, so only the extracted region is ever read.
+//==============================================================
+
+int EnviOpen(const char *filename, EnviCube *cube)
+{
+  long long nElem = (long long) cube->nRow*cube->nCol*cube->nBand;
+  int size = EnviTypeSize(cube->DataType);
+  cube->Data   = NULL;
+  cube->nByte  = 0;
+  cube->Handle = NULL;
+  if (!size) return 3;
+#ifdef _WIN32
+  LARGE_INTEGER len;
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file==INVALID_HANDLE_VALUE) return 1;
+  if (!GetFileSizeEx(file, &len)) { CloseHandle(file); return 1; }
+  cube->nByte = len.QuadPart;
+  if (cube->nByte < cube->Offset + nElem*size) { CloseHandle(file); return 2; }
+  HANDLE map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);            // mapping keeps the file open
+  if (!map) return 1;
+  cube->Data = (const uchar*) MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+  if (!cube->Data) { CloseHandle(map); return 1; }
+  cube->Handle = map;
+#else
+  struct stat st;
+  int fd = open(filename, O_RDONLY);
+  if (fd<0) return 1;
+  if (fstat(fd, &st)) { close(fd); return 1; }
+  cube->nByte = st.st_size;
+  if (cube->nByte < cube->Offset + nElem*size) { close(fd); return 2; }
+  if ((unsigned long long) cube->nByte > (size_t) -1) { close(fd); return 1; }
+  void *p = mmap(NULL, (size_t) cube->nByte, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);                    // mapping keeps the file open
+  if (p==MAP_FAILED) return 1;
+  cube->Data = (const uchar*) p;
+#endif
+  return 0;
+}
+
+void EnviClose(EnviCube *cube)
+{
+  if (!cube->Data) return;
+#ifdef _WIN32
+  UnmapViewOfFile((LPCVOID) cube->Data);
+  CloseHandle((HANDLE) cube->Handle);
+#else
+  munmap((void*) cube->Data, (size_t) cube->nByte);
+#endif
+  cube->Data   = NULL;
+  cube->Handle = NULL;
+}
+
+//==============================================================
+// Extraction of a region of the cube
+//==============================================================
+
+template<class T> inline T Load(const uchar *p, bool swap)
+{ // read possibly unaligned number, reversing its bytes if needed
+  T x;
+  if (swap) {
+    uchar b[sizeof(T)];
+    for (size_t i=0; i<sizeof(T); i++) b[i] = p[sizeof(T)-1-i];
+    memcpy(&x, b, sizeof(T));
+  } else memcpy(&x, p, sizeof(T));
+  return x;
+}
+
+//--------------------------------------------------------------------------
+// Dimensions of the region are given in the order of loops: outer, middle,
+// inner, with the inner one being the fastest changing dimension in the
+// file, so the file is read sequentially. Loops are done in tiles, since
+// the fastest changing dimension of the output is a different one. Tiles
+// are distributed among threads. Each element has nc components: 1 for
+// real numbers and 2 for complex ones. Runs of consecutive elements along
+// the inner dimension are byte swapped in bulk into a small buffer.
+//--------------------------------------------------------------------------
+template<class Tin, class Tout, int nc>
+static void Extract(const EnviCube *cube, const int *idx[3], const int n[3],
+                    const long long fs[3], const long long os[3], Tout *out)
+{
+  const int B0 = (os[0]==1 ? 16 : 1);   // tile size: outer loop is tiled only if
+  const int B1 = 16, B2 = 64;           // it is the fastest dimension of output
+  const uchar *data = cube->Data + cube->Offset;
+  const long long size = nc*sizeof(Tin);
+  const bool swap = cube->Swap;
+  const long nt1 = (n[1]+B1-1)/B1, nTile = (n[0]+B0-1)/B0*nt1;
+  #pragma omp parallel for schedule(dynamic) if ((double) n[0]*n[1]*n[2] > 65536)
+  for (long t=0; t<nTile; t++) {
+    int b0 = (int) (t/nt1)*B0, e0 = (b0+B0 < n[0] ? b0+B0 : n[0]);
+    int b1 = (int) (t%nt1)*B1, e1 = (b1+B1 < n[1] ? b1+B1 : n[1]);
+    for (int b2=0; b2<n[2]; b2+=B2) {
+      int e2 = (b2+B2 < n[2] ? b2+B2 : n[2]);
+      bool run = (swap && sizeof(Tin)>1);   // swap consecutive elements in bulk?
+      for (int i2=b2+1; i2<e2 && run; i2++) run = (idx[2][i2]==idx[2][i2-1]+1);
+      for (int i0=b0; i0<e0; i0++) {
+        for (int i1=b1; i1<e1; i1++) {
+          const uchar *p = data + (idx[0][i0]*fs[0] + idx[1][i1]*fs[1])*size;
+          Tout *o = out + (i0*os[0] + i1*os[1])*nc;
+          if (run) {
+            uchar buf[B2*nc*sizeof(Tin)];
+            SwapCopy(buf, p + idx[2][b2]*fs[2]*size, (e2-b2)*nc, sizeof(Tin));
+            for (int i2=b2; i2<e2; i2++)
+              for (int c=0; c<nc; c++)
+                o[i2*os[2]*nc+c] = (Tout) Load<Tin>(buf+((i2-b2)*nc+c)*sizeof(Tin), false);
+          } else {
+            for (int i2=b2; i2<e2; i2++) {
+              const uchar *q = p + idx[2][i2]*fs[2]*size;
+              for (int c=0; c<nc; c++)
+                o[i2*os[2]*nc+c] = (Tout) Load<Tin>(q+c*sizeof(Tin), swap);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void EnviExtract(const EnviCube *cube, const int *rows, int nr, const int *cols,
+                 int nc, const int *bands, int nb, void *out, bool packed)
+{
+  // per dimension (row, col, band): index list, its length, stride in the
+  // file and stride in the output, all in elements
+  const int *list[3] = {rows, cols, bands};
+  int len[3] = {nr, nc, nb}, perm[3];
+  long long nRow=cube->nRow, nCol=cube->nCol, nBand=cube->nBand, fstride[3];
+  long long ostride[3] = {1, (long long) nr, (long long) nr*nc};
+  switch (cube->Interleave) {
+    case ENVI_BIL:              // [col, band, row]
+      fstride[0] = nCol*nBand; fstride[1] = 1; fstride[2] = nCol;
+      perm[0] = 0; perm[1] = 2; perm[2] = 1;
+      break;
+    case ENVI_BIP:              // [band, col, row]
+      fstride[0] = nCol*nBand; fstride[1] = nBand; fstride[2] = 1;
+      perm[0] = 0; perm[1] = 1; perm[2] = 2;
+      break;
+    default:                    // ENVI_BSQ: [col, row, band]
+      fstride[0] = nCol; fstride[1] = 1; fstride[2] = nCol*nRow;
+      perm[0] = 2; perm[1] = 0; perm[2] = 1;
+  }
+  const int *idx[3];
+  int n[3];
+  long long fs[3], os[3];
+  for (int k=0; k<3; k++) {     // put dimensions in loop order
+    idx[k] = list   [perm[k]];
+    n  [k] = len    [perm[k]];
+    fs [k] = fstride[perm[k]];
+    os [k] = ostride[perm[k]];
+  }
+  if (!n[0] || !n[1] || !n[2]) return;
+  if (packed) switch (cube->DataType) {
+    case ENVI_UINT8:   Extract<uchar,          uchar,          1>(cube, idx, n, fs, os, (uchar*) out); return;
+    case ENVI_INT16:
+    case ENVI_UINT16:  Extract<unsigned short, unsigned short, 1>(cube, idx, n, fs, os, (unsigned short*) out); return;
+  }
+  switch (cube->DataType) {
+    case ENVI_UINT8:   Extract<uchar,              int,    1>(cube, idx, n, fs, os, (int*)    out); break;
+    case ENVI_INT16:   Extract<short,              int,    1>(cube, idx, n, fs, os, (int*)    out); break;
+    case ENVI_INT32:   Extract<int,                int,    1>(cube, idx, n, fs, os, (int*)    out); break;
+    case ENVI_FLOAT:   Extract<float,              double, 1>(cube, idx, n, fs, os, (double*) out); break;
+    case ENVI_DOUBLE:  Extract<double,             double, 1>(cube, idx, n, fs, os, (double*) out); break;
+    case ENVI_CFLOAT:  Extract<float,              double, 2>(cube, idx, n, fs, os, (double*) out); break;
+    case ENVI_COMPLEX: Extract<double,             double, 2>(cube, idx, n, fs, os, (double*) out); break;
+    case ENVI_UINT16:  Extract<unsigned short,     int,    1>(cube, idx, n, fs, os, (int*)    out); break;
+    case ENVI_UINT32:  Extract<unsigned int,       double, 1>(cube, idx, n, fs, os, (double*) out); break;
+    case ENVI_INT64:   Extract<long long,          double, 1>(cube, idx, n, fs, os, (double*) out); break;
+    case ENVI_UINT64:  Extract<unsigned long long, double, 1>(cube, idx, n, fs, os, (double*) out); break;
+  }
+}
+
+//==============================================================
+// Writing of the cube
+//==============================================================
+
+template<class T> inline void Store(uchar *p, T x, bool swap)
+{ // write possibly unaligned number, reversing its bytes if needed
+  if (swap) {
+    uchar b[sizeof(T)];
+    memcpy(b, &x, sizeof(T));
+    for (size_t i=0; i<sizeof(T); i++) p[i] = b[sizeof(T)-1-i];
+  } else memcpy(p, &x, sizeof(T));
+}
+
+template<class Tout, class Tin> inline Tout Convert(Tin x) { return (Tout) x; }
+template<> inline float  Convert<float,  int>(int x) { return (x==NA_INTEGER ? (float) NA_REAL : (float) x); }
+template<> inline double Convert<double, int>(int x) { return (x==NA_INTEGER ? NA_REAL : (double) x); }
+template<> inline unsigned int Convert<unsigned int, double>(double x) { return (ISNAN(x) ? 0 : (unsigned int) x); }
+template<> inline long long Convert<long long, double>(double x) { return (ISNAN(x) ? 0 : (long long) x); }
+template<> inline unsigned long long Convert<unsigned long long, double>(double x) { return (ISNAN(x) ? 0 : (unsigned long long) x); }
+
+//--------------------------------------------------------------------------
+// Copy n0 x n1 block of 'src' with strides s0, s1 to 'dst' with strides
+// d0, d1 (all in elements), converting each of nc components to Tout.
+// Done in T x T tiles so that both the source and the destination stay
+// in cache, whichever of them is accessed with a large stride.
+//--------------------------------------------------------------------------
+template<class Tin, class Tout, int nc>
+static void Transpose(const Tin *src, long long s0, long long s1, int n0, int n1,
+                      uchar *dst, long long d0, long long d1, bool swap)
+{
+  const int T = 64;
+  const long nt1 = (n1+T-1)/T;
+  #pragma omp parallel for schedule(static) if ((double) n0*n1 > 65536)
+  for (long t=0; t<nt1; t++) {
+    int k0 = (int) t*T, k1 = (k0+T < n1 ? k0+T : n1);
+    for (int i0=0; i0<n0; i0+=T) {
+      int i1 = (i0+T < n0 ? i0+T : n0);
+      for (int k=k0; k<k1; k++) {
+        const Tin *s = src + k*s1*nc;
+        uchar     *d = dst + k*d1*nc*sizeof(Tout);
+        for (int i=i0; i<i1; i++)
+          for (int c=0; c<nc; c++)
+            Store<Tout>(d + (i*d0*nc+c)*sizeof(Tout), Convert<Tout>(s[i*s0*nc+c]), swap);
+      }
+    }
+  }
+}
+
+//--------------------------------------------------------------------------
+// The file is written in blocks of nb rows. For BSQ each band of a block is
+// a transpose of [row, col] matrix; for BIL the whole block is a transpose
+// of [row, col*band] matrix and for BIP each column of a block is a
+// transpose of [row, band] matrix. Only a single block is kept in memory.
+//--------------------------------------------------------------------------
+template<class Tin, class Tout, int nc>
+static int WriteCube(FILE *fp, const Tin *data, int nRow, int nCol, int nBand,
+                     int Interleave, bool swap)
+{
+  const long long size = nc*sizeof(Tout), nRC = (long long) nRow*nCol;
+  long long rowBytes = (Interleave==ENVI_BSQ ? nCol : (long long) nCol*nBand)*size;
+  int nb = (int) ((1<<23)/rowBytes);      // rows per block: about 8MB of buffer
+  if (nb>64) nb = 64;
+  if (nb<1)  nb = 1;
+  uchar *buffer = (uchar*) malloc(nb*rowBytes);
+  if (!buffer) return 2;
+  int stats = 0;
+  for (int b=0; b<(Interleave==ENVI_BSQ ? nBand : 1) && !stats; b++) {
+    for (int r0=0; r0<nRow && !stats; r0+=nb) {
+      int n = (r0+nb < nRow ? nb : nRow-r0);
+      const Tin *src = data + (r0 + b*nRC)*nc;
+      switch (Interleave) {
+        case ENVI_BSQ:   // block[row][col]
+          Transpose<Tin,Tout,nc>(src, 1, nRow, n, nCol, buffer, nCol, 1, swap);
+          break;
+        case ENVI_BIL:   // block[row][band][col]
+          Transpose<Tin,Tout,nc>(src, 1, nRow, n, nCol*nBand, buffer, (long long) nCol*nBand, 1, swap);
+          break;
+        case ENVI_BIP:   // block[row][col][band]
+          for (int c=0; c<nCol; c++)
+            Transpose<Tin,Tout,nc>(src + (long long) c*nRow*nc, 1, nRC, n, nBand,
+                                   buffer + c*nBand*size, (long long) nCol*nBand, 1, swap);
+          break;
+      }
+      if (fwrite(buffer, 1, n*rowBytes, fp) != (size_t) (n*rowBytes)) stats = 2;
+    }
+  }
+  free(buffer);
+  return stats;
+}
+
+int EnviWrite(const char *filename, const void *data, int RType, int nRow,
+              int nCol, int nBand, int DataType, int Interleave, bool swap)
+{
+  const int    *I = (const int*)    data;
+  const double *D = (const double*) data;
+  bool complex = (DataType==ENVI_COMPLEX || DataType==ENVI_CFLOAT);
+  bool narrow  = (DataType==ENVI_UINT8 || DataType==ENVI_INT16 ||
+                  DataType==ENVI_INT32 || DataType==ENVI_UINT16);
+  if ((RType==CPLXSXP) != complex) return 3;
+  if (RType==REALSXP && narrow) return 3;   // doubles can't go to int types that fit in R's int
+  if (!EnviTypeSize(DataType)) return 3;
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) return 1;
+  int stats = 0;
+  if (RType==INTSXP) {
+    switch (DataType) {
+      case ENVI_UINT8:  stats = WriteCube<int, uchar,          1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_INT16:  stats = WriteCube<int, short,          1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_INT32:  stats = WriteCube<int, int,            1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_FLOAT:  stats = WriteCube<int, float,          1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_DOUBLE: stats = WriteCube<int, double,         1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_UINT16: stats = WriteCube<int, unsigned short, 1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_UINT32: stats = WriteCube<int, unsigned int,   1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_INT64:  stats = WriteCube<int, long long,      1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_UINT64: stats = WriteCube<int, unsigned long long, 1>(fp, I, nRow, nCol, nBand, Interleave, swap); break;
+    }
+  } else {
+    switch (DataType) {
+      case ENVI_FLOAT:   stats = WriteCube<double, float,  1>(fp, D, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_DOUBLE:  stats = WriteCube<double, double, 1>(fp, D, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_CFLOAT:  stats = WriteCube<double, float,  2>(fp, D, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_COMPLEX: stats = WriteCube<double, double, 2>(fp, D, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_UINT32:  stats = WriteCube<double, unsigned int,       1>(fp, D, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_INT64:   stats = WriteCube<double, long long,          1>(fp, D, nRow, nCol, nBand, Interleave, swap); break;
+      case ENVI_UINT64:  stats = WriteCube<double, unsigned long long, 1>(fp, D, nRow, nCol, nBand, Interleave, swap); break;
+    }
+  }
+  if (fclose(fp)) stats = 2;
+  return stats;
+}
+
+//==============================================================
+// Streaming of the cube in tiles
+//==============================================================
+
+int EnviStreamOpen(const char *filename, EnviStream *s)
+{
+  const EnviCube *cube = &s->Cube;
+  int nrb = (cube->nRow +s->nTileRow -1)/s->nTileRow;
+  int nbb = (cube->nBand+s->nTileBand-1)/s->nTileBand;
+  s->nTile  = nrb*nbb;
+  s->iTile  = 0;
+  s->Thread = NULL;
+  return EnviOpen(filename, &s->Cube);
+}
+
+void EnviStreamClose(EnviStream *s)
+{
+  EnviWait(s);
+  EnviClose(&s->Cube);
+}
+
+void EnviTileRange(const EnviStream *s, int tile, int *row, int *nr, int *band, int *nb)
+{
+  const EnviCube *cube = &s->Cube;
+  int nrb = (cube->nRow +s->nTileRow -1)/s->nTileRow, ir, ib;
+  int nbb = (cube->nBand+s->nTileBand-1)/s->nTileBand;
+  if (cube->Interleave==ENVI_BSQ) { ib = tile/nrb; ir = tile%nrb; }
+  else                            { ir = tile/nbb; ib = tile%nbb; }
+  *row  = ir*s->nTileRow;
+  *band = ib*s->nTileBand;
+  *nr   = (*row +s->nTileRow  < cube->nRow  ? s->nTileRow  : cube->nRow -*row );
+  *nb   = (*band+s->nTileBand < cube->nBand ? s->nTileBand : cube->nBand-*band);
+}
+
+//--------------------------------------------------------------------------
+// Run the kernel along the band dimension of [pixel, band] array. Spectra
+// of 16 pixels at a time are gathered into a buffer, so memory is accessed
+// in runs of 16 elements. 'in' and 'out' can be the same array.
+//--------------------------------------------------------------------------
+template<class T>
+static void Smooth(const T *in, double *out, long long nPix, int nb,
+                   EnviKernel kernel, int nWin)
+{
+  const int B = 16;
+  if (nWin>nb) nWin = nb;
+  #pragma omp parallel if ((double) nPix*nb > 65536)
+  {
+    double *x = (double*) malloc(2*B*nb*sizeof(double)), *y = x+B*nb;
+    #pragma omp for schedule(static)
+    for (long long p0=0; p0<nPix; p0+=B) {
+      int np = (int) (p0+B < nPix ? B : nPix-p0);
+      for (int b=0; b<nb; b++)
+        for (int p=0; p<np; p++) x[p*nb+b] = Convert<double>(in[b*nPix+p0+p]);
+      for (int p=0; p<np; p++) kernel(x+p*nb, y+p*nb, &nb, &nWin);
+      for (int b=0; b<nb; b++)
+        for (int p=0; p<np; p++) out[b*nPix+p0+p] = y[p*nb+b];
+    }
+    free(x);
+  }
+}
+
+void EnviReadTile(const EnviStream *s, int tile, void *out)
+{
+  const EnviCube *cube = &s->Cube;
+  int row, nr, band, nb, nc = cube->nCol, i;
+  EnviTileRange(s, tile, &row, &nr, &band, &nb);
+  int *rows = (int*) malloc((nr+nc+nb)*sizeof(int)), *cols = rows+nr, *bands = cols+nc;
+  for (i=0; i<nr; i++) rows [i] = row+i;
+  for (i=0; i<nc; i++) cols [i] = i;
+  for (i=0; i<nb; i++) bands[i] = band+i;
+  long long nPix = (long long) nr*nc;
+  bool isInt = (cube->DataType==ENVI_UINT8 || cube->DataType==ENVI_INT16 ||
+                cube->DataType==ENVI_INT32 || cube->DataType==ENVI_UINT16);
+  if (!s->Kernel) {
+    EnviExtract(cube, rows, nr, cols, nc, bands, nb, out, s->Packed);
+  } else if (isInt) {           // read as int and smooth into doubles
+    int *buf = (int*) malloc(nPix*nb*sizeof(int));
+    EnviExtract(cube, rows, nr, cols, nc, bands, nb, buf);
+    Smooth<int>(buf, (double*) out, nPix, nb, s->Kernel, s->nWin);
+    free(buf);
+  } else {                      // read as doubles and smooth in place
+    EnviExtract(cube, rows, nr, cols, nc, bands, nb, out);
+    Smooth<double>((double*) out, (double*) out, nPix, nb, s->Kernel, s->nWin);
+  }
+  free(rows);
+}
+
+void EnviPrefetch(EnviStream *s, int tile, void *out)
+{
+  EnviWait(s);
+  s->Thread = new std::thread(EnviReadTile, s, tile, out);
+}
+
+void EnviWait(EnviStream *s)
+{
+  std::thread *t = (std::thread*) s->Thread;
+  if (!t) return;
+  t->join();
+  delete t;
+  s->Thread = NULL;
+}
@@ -0,0 +1,123 @@
+/*===========================================================================*/
+/* EnviTools - reading and writing of ENVI binary data cubes                 */
+/* Copyright (C) 2005 Jarek Tuszynski                                        */
+/* Distributed under GNU General Public License version 3                    */
+/*===========================================================================*/
+
+#ifndef ENVI_TOOLS_H
+#define ENVI_TOOLS_H
+#include <R.h>
+#include <Rinternals.h>
+
+extern "C" {
+  #define print Rprintf
+  #define Error Rf_error
+  typedef unsigned char uchar;
+
+  // ENVI "data type" codes
+  #define ENVI_UINT8     1
+  #define ENVI_INT16     2
+  #define ENVI_INT32     3
+  #define ENVI_FLOAT     4
+  #define ENVI_DOUBLE    5
+  #define ENVI_CFLOAT    6    // 2 floats
+  #define ENVI_COMPLEX   9    // 2 doubles
+  #define ENVI_UINT16   12
+  #define ENVI_UINT32   13
+  #define ENVI_INT64    14
+  #define ENVI_UINT64   15
+
+  // ENVI "interleave": order of dimensions in the file, fastest changing first
+  #define ENVI_BSQ 0          // [col, row, band]
+  #define ENVI_BIL 1          // [col, band, row]
+  #define ENVI_BIP 2          // [band, col, row]
+
+  //------------------------------------------------------------------
+  // ENVI data cube mapped into memory. Nothing is read until a region
+  // is extracted, so cubes larger than memory can be accessed.
+  //------------------------------------------------------------------
+  typedef struct {
+    int  nRow, nCol, nBand;  // "lines", "samples" and "bands" of the header
+    int  DataType;           // one of ENVI_* data type codes
+    int  Interleave;         // ENVI_BSQ, ENVI_BIL or ENVI_BIP
+    bool Swap;               // is byte order of the file different from ours?
+    long long Offset;        // "header offset": bytes before the raster data
+    const uchar *Data;       // mapped file
+    long long nByte;         // size of the mapped file
+    void *Handle;            // file mapping handle (Windows only)
+  } EnviCube;
+
+  //------------------------------------------------------------------
+  // Parsed header file: "key = value" pairs. Keys are lower case, with
+  // single spaces between words. Values in {} can span many lines and
+  // are split at commas, except for "description".
+  //------------------------------------------------------------------
+  typedef struct {
+    char *Key;
+    int   nItem;
+    char **Item;
+  } EnviField;
+
+  typedef struct {
+    int nField, nAlloc;
+    EnviField *Field;
+  } EnviHeader;
+
+  int  EnviReadHeader(const char *filename, EnviHeader *hdr); // 0 - OK, 1 - can not open
+  void EnviFreeHeader(EnviHeader *hdr);
+
+  int  EnviTypeSize(int DataType);   // bytes per element or 0 if unsupported
+  // map the file; cube fields other than Data, nByte and Handle are set by the
+  // caller. Returns 0 - OK, 1 - can not open or map the file, 2 - file too short,
+  // 3 - unsupported data type
+  int  EnviOpen(const char *filename, EnviCube *cube);
+  void EnviClose(EnviCube *cube);
+  // Copy cube[rows, cols, bands] (0-based indices) to 'out' in R's
+  // [row, col, band] order, converting to int (up to 16 bit integer types and
+  // int32), double (float types and 32/64 bit unsigned and 64 bit integers)
+  // or pairs of doubles (complex), with byte swapping if needed. If 'packed'
+  // 8 and 16 bit types are kept as they are, in this machine's byte order.
+  void EnviExtract(const EnviCube *cube, const int *rows, int nr, const int *cols,
+                   int nc, const int *bands, int nb, void *out, bool packed=false);
+  // Write nRow x nCol x nBand array 'data' stored in R's [row, col, band] order
+  // as int (RType=INTSXP), double (REALSXP) or pairs of doubles (CPLXSXP) to
+  // a binary file of given data type and interleave, swapping bytes if asked.
+  // Returns 0 - OK, 1 - can not open the file, 2 - write error, 3 - data type
+  // not supported or not compatible with RType.
+  int  EnviWrite(const char *filename, const void *data, int RType, int nRow,
+                 int nCol, int nBand, int DataType, int Interleave, bool swap);
+
+  //------------------------------------------------------------------
+  // Stream of tiles covering the cube: full width, nTileRow rows and
+  // nTileBand bands each, visited in the order they are stored in the
+  // file (band blocks are the outer loop for BSQ and the inner one for
+  // BIL and BIP), so the file is read sequentially. The next tile is read
+  // by a background thread while the current one is in use. If Kernel is
+  // set, spectrum of each pixel is passed through a running window
+  // function with the signature of runmean in runfunc.c, and tiles are
+  // returned as doubles.
+  //------------------------------------------------------------------
+  typedef void (*EnviKernel)(double *In, double *Out, const int *nIn, const int *nWin);
+
+  typedef struct {
+    EnviCube Cube;           // stream's own mapping of the file
+    int  nTileRow, nTileBand;
+    int  nTile, iTile;       // number of tiles and the next one to return
+    bool Packed;             // same as in EnviExtract
+    EnviKernel Kernel;       // running window along bands or NULL
+    int  nWin;               // its window size
+    void *Thread;            // pending prefetch or NULL
+  } EnviStream;
+
+  // Cube and tile fields set by the caller; maps the file the same as EnviOpen
+  int  EnviStreamOpen(const char *filename, EnviStream *s);
+  void EnviStreamClose(EnviStream *s);
+  // first row and band of the tile and its size
+  void EnviTileRange(const EnviStream *s, int tile, int *row, int *nr, int *band, int *nb);
+  // read tile to 'out' as [row, col, band] array, now or in the background
+  void EnviReadTile(const EnviStream *s, int tile, void *out);
+  void EnviPrefetch(EnviStream *s, int tile, void *out);
+  void EnviWait(EnviStream *s);   // wait for the pending prefetch
+}
+
+#endif
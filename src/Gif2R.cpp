@@ -10,56 +10,362 @@
 #include "GifTools.h"
 extern "C" {
       
-  void imwritegif(char** filename, 
-                int* Data, int *ColorMap, int *param, char** comment)
-  {
-    int i, nPixel = param[0]*param[1]*param[2];
-    bool Interlace = (param[6]!=0);
+  //------------------------------------------------------------------
+  // Scaling, casting and transposition of R images done in a single pass
+  //------------------------------------------------------------------
   
-    uchar* data = R_Calloc(nPixel, uchar);
-    for(i=0; i<nPixel; i++) data[i] = Data[i]&0xff;
-    param[7] = imwriteGif(*filename, data, param[0], param[1], param[2], 
-      param[3], ColorMap, Interlace, param[4], param[5], *comment);
+  SEXP gifrange(SEXP Image)
+  { // returns min & max of finite pixels, number of non-finite pixels and 
+    // whether any pixel is not an integer: all needed to choose the scaling
+    long k, n = XLENGTH(Image), nNA=0;
+    int fraction=0;
+    double minx=R_PosInf, maxx=R_NegInf;
+    const double *dIn = (TYPEOF(Image)==REALSXP ? REAL(Image) : NULL);
+    const int    *iIn = (TYPEOF(Image)==REALSXP ? NULL : INTEGER(Image));
+    SEXP Ret;
+    #pragma omp parallel for schedule(static) reduction(min:minx) reduction(max:maxx,fraction) reduction(+:nNA)
+    for (k=0; k<n; k++) {
+      double v;
+      if (dIn) {
+        v = dIn[k];
+        if (!R_FINITE(v)) { nNA++; continue; }
+        if (v!=floor(v)) fraction=1;
+      } else {
+        if (iIn[k]==NA_INTEGER) { nNA++; continue; }
+        v = iIn[k];
+      }
+      if (v<minx) minx=v;
+      if (v>maxx) maxx=v;
+    }
+    PROTECT(Ret = Rf_allocVector(REALSXP, 4));
+    REAL(Ret)[0] = minx;
+    REAL(Ret)[1] = maxx;
+    REAL(Ret)[2] = (double) nNA;
+    REAL(Ret)[3] = fraction;
+    UNPROTECT(1);
+    return Ret;
+  }
+  
+  static int ScaleImage(const double *dIn, const int *iIn, int nRow, int nCol, 
+                        int nBand, bool flip, double a, double b, double hi, 
+                        int transparent, uchar *data)
+  { // Converts R's nRow x nCol x nBand array to GIF frames of pixels (x-a)*b, 
+    // clipped to [0, hi] and rounded. Frames are transposed (or flipped) in 
+    // 64x64 tiles to keep both reads and writes cache friendly.
+    // returns: the largest pixel value
+    const int tile=64;
+    long t, nPixel = (long) nRow*nCol;
+    int  nTile = (nCol+tile-1)/tile, imMax=0;
+    if (transparent<0) transparent=0;
+    #pragma omp parallel for schedule(static) reduction(max:imMax)
+    for (t=0; t<nBand*(long)nTile; t++) {
+      long band = t/nTile, k, o;
+      int  r, c, r0, c0 = static_cast<int>(t%nTile)*tile, p;
+      int  c1 = (c0+tile<nCol ? c0+tile : nCol);
+      for (r0=0; r0<nRow; r0+=tile) {
+        int r1 = (r0+tile<nRow ? r0+tile : nRow);
+        for (c=c0; c<c1; c++) {
+          k = band*nPixel + (long) c*nRow;        // R's column c
+          o = band*nPixel + (flip ? (long) (nCol-1-c)*nRow : c);
+          for (r=r0; r<r1; r++) {
+            if (dIn ? !R_FINITE(dIn[k+r]) : iIn[k+r]==NA_INTEGER) p = transparent;
+            else {
+              double v = ((dIn ? dIn[k+r] : iIn[k+r]) - a)*b;
+              p = static_cast<int>(nearbyint(v<0 ? 0 : (v>hi ? hi : v)));
+            }
+            data[flip ? o+r : o+(long) r*nCol] = static_cast<uchar>(p);
+            if (p>imMax) imMax=p;
+          }
+        }
+      }
+    }
+    return imMax;
+  }
+  
+  SEXP gifwrite(SEXP filename, SEXP Image, SEXP ColorMap, SEXP Param, SEXP Comment)
+  { // native version of write.gif: original R array is scaled, cast and 
+    // transposed straight into the only copy of the image handed to encoder
+    double *param = REAL(Param); // nRow, nCol, nBand, a, b, mColor, transparent, 
+                                 // flip, delay, interlace, optimize, nColor
+    int  nRow=(int) param[0], nCol=(int) param[1], nBand=(int) param[2];
+    int  transparent=(int) param[6], nColor=(int) param[11], imMax, filesize;
+    bool flip=(param[7]!=0);
+    uchar* data = R_Calloc((long) nRow*nCol*nBand, uchar);
+    imMax = ScaleImage(TYPEOF(Image)==REALSXP ? REAL(Image) : NULL, 
+                       TYPEOF(Image)==REALSXP ? NULL : INTEGER(Image), 
+                       nRow, nCol, nBand, flip, param[3], param[4], param[5], 
+                       transparent, data);
+    if (imMax>nColor) {
+      R_Free(data);
+      Rf_error("write.gif: not enough colors in color palette 'col'");
+    }
+    // GIF rows are R's rows, or R's columns in reverse order if flipped
+    filesize = imwriteGif(CHAR(STRING_ELT(filename, 0)), data, flip ? nCol : nRow, 
+      flip ? nRow : nCol, nBand, nColor, INTEGER(ColorMap), param[9]!=0, 
+      transparent, (int) param[8], (char*) CHAR(STRING_ELT(Comment, 0)), 
+      param[10]!=0, imMax);
     R_Free(data);
+    return Rf_ScalarInteger(filesize);
   }
   
-  SEXP imreadgif(SEXP filename, SEXP NImage, SEXP Verbose)
-  { // The only R specific function
-    int i, j, nPixel, nRow, nCol, nBand, ColorMap[256]; 
-    int transparent, success, *ret, nImage, verbose;
-    char *comment;
-    const char *fname;
-    uchar* data=0;
-    SEXP Ret;
-    SEXP scomm;
-  
-    // initialize data 
-    nRow=nCol=nBand=transparent=0;
-    comment = NULL;
-    nImage  = Rf_asInteger(NImage);    
-    verbose = Rf_asInteger(Verbose);    
-    fname   = CHAR(STRING_ELT(filename, 0));
-    success = imreadGif(fname, nImage, (bool) verbose, &data, nRow, nCol, 
-              nBand, ColorMap, transparent, &comment); 
-    nPixel  = nRow*nCol*nBand;
-    PROTECT(Ret = Rf_allocVector(INTSXP, 9+256+nPixel));
-    ret     = (int*) INTEGER(Ret);  /* get pointer to R's Ret */
-    ret[0]  = nRow;       // pack output into array of integers
-    ret[1]  = nCol;
-    ret[2]  = nBand;
-    ret[3]  = transparent;
-    ret[4]  = success;
-    j=9;
-    for(i=0; i<256   ; i++) ret[j++] = ColorMap[i];
-    for(i=0; i<nPixel; i++) ret[j++] = data[i];
+  static bool PackColors(const double *dIn, const int *iIn, int nRow, int nCol, 
+                         int nBand, bool flip, double b, bool alpha, int *rgb)
+  { // Converts R's nRow x nCol x 3 x nBand array of red, green and blue 
+    // intensities, or 4 x nRow*nCol*nBand matrix of colors from col2rgb 
+    // (alpha), to GIF frames of 0xRRGGBB pixels. Intensities are scaled by b, 
+    // clipped to [0, 255] and rounded. Non-finite intensities and fully 
+    // transparent colors give -1. Same tiles and orientation as ScaleImage.
+    // returns: were any transparent pixels found?
+    const int tile=64;
+    long t, nPixel = (long) nRow*nCol;
+    int  nTile = (nCol+tile-1)/tile, nTrans=0;
+    #pragma omp parallel for schedule(static) reduction(+:nTrans)
+    for (t=0; t<nBand*(long)nTile; t++) {
+      long band = t/nTile, k, o;
+      int  r, c, ch, r0, c0 = static_cast<int>(t%nTile)*tile, p;
+      int  c1 = (c0+tile<nCol ? c0+tile : nCol);
+      for (r0=0; r0<nRow; r0+=tile) {
+        int r1 = (r0+tile<nRow ? r0+tile : nRow);
+        for (c=c0; c<c1; c++) {
+          k = (long) c*nRow;                      // R's column c
+          o = band*nPixel + (flip ? (long) (nCol-1-c)*nRow : c);
+          for (r=r0; r<r1; r++) {
+            if (alpha) {
+              const int *q = iIn + 4*(band*nPixel+k+r);
+              p = (q[3]==0 ? -1 : (q[0]<<16) | (q[1]<<8) | q[2]);
+            } else for (p=0, ch=0; ch<3; ch++) {
+              long m = (3*band+ch)*nPixel + k+r;
+              if (dIn ? !R_FINITE(dIn[m]) : iIn[m]==NA_INTEGER) { p=-1; break; }
+              double v = (dIn ? dIn[m] : iIn[m])*b;
+              p |= static_cast<int>(nearbyint(v<0 ? 0 : (v>255 ? 255 : v))) << (16-8*ch);
+            }
+            rgb[flip ? o+r : o+(long) r*nCol] = p;
+            if (p<0) nTrans++;
+          }
+        }
+      }
+    }
+    return nTrans>0;
+  }
+  
+  SEXP gifwritergb(SEXP filename, SEXP Image, SEXP Param, SEXP Comment)
+  { // true-color version of gifwrite: Image is an array of intensities or a 
+    // matrix of colors (see PackColors), palette is designed by QuantizeColors
+    double *param = REAL(Param); // nRow, nCol, nBand, b, alpha, flip, delay, 
+                                 // interlace, optimize, dither
+    int  nRow=(int) param[0], nCol=(int) param[1], nBand=(int) param[2];
+    int  nColor, transparent=-1, filesize, ColorMap[256];
+    bool flip=(param[5]!=0);
+    int  Width=(flip ? nRow : nCol), Height=(flip ? nCol : nRow);
+    long nPixel = (long) nRow*nCol*nBand;
+    int*   rgb  = R_Calloc(nPixel, int);
+    uchar* data = R_Calloc(nPixel, uchar);
+    if (PackColors(TYPEOF(Image)==REALSXP ? REAL(Image) : NULL, 
+                   TYPEOF(Image)==REALSXP ? NULL : INTEGER(Image), 
+                   nRow, nCol, nBand, flip, param[3], param[4]!=0, rgb)) 
+      transparent = 255;
+    // reserve the last color for transparent pixels if there are any
+    memset(ColorMap, 0, 256*sizeof(int));
+    nColor = QuantizeColors(rgb, nPixel, transparent<0 ? 256 : 255, ColorMap);
+    MapColors(rgb, Width, Height, nBand, ColorMap, nColor, param[9]!=0, transparent, data);
+    R_Free(rgb);
+    if (transparent>=0) nColor = 256;
+    filesize = imwriteGif(CHAR(STRING_ELT(filename, 0)), data, Height, Width, nBand, 
+      nColor, ColorMap, param[7]!=0, transparent, (int) param[6], 
+      (char*) CHAR(STRING_ELT(Comment, 0)), param[8]!=0);
     R_Free(data);
-    if(comment && strlen(comment)) { // if comment was found than pack it too
-      scomm = Rf_install("comm");
-      Rf_setAttrib(Ret, scomm, Rf_mkString(comment));
+    return Rf_ScalarInteger(filesize);
+  }
+  
+  static SEXP AllocImage(SEXPTYPE type, int nChannel, int d1, int d2, int nFrame)
+  { // array of nChannel x d1 x d2 x nFrame pixels, with singleton dimensions dropped
+    int i=0, dim[4];
+    SEXP Image, Dim;
+    if (nChannel>1) dim[i++] = nChannel;
+    dim[i++] = d1;
+    dim[i++] = d2;
+    if (nFrame>1) dim[i++] = nFrame;
+    PROTECT(Image = Rf_allocVector(type, (R_xlen_t) nChannel*d1*d2*nFrame));
+    PROTECT(Dim = Rf_allocVector(INTSXP, i));
+    memcpy(INTEGER(Dim), dim, i*sizeof(int));
+    Rf_setAttrib(Image, R_DimSymbol, Dim);
+    UNPROTECT(2);
+    return Image;
+  }
+  
+  SEXP imreadgif(SEXP filename, SEXP NImage, SEXP Verbose, SEXP Flip, SEXP Raw, SEXP Rgb)
+  { // returns list(image, color map, transparent color, comment, status).
+    // Frames are decoded straight into R array, already in R's orientation.
+    // Colors are either indices or, if Rgb is set, RGBA colors with palette 
+    // lookup done while decoding: packed into native raster integers or 
+    // stored as 4 raw bytes per pixel. Colors are stored row by row.
+    int nRow=0, nCol=0, iFirst=0, nFrame=0, nGood, stats, filesize, transparent=-1;
+    int rgb = Rf_asInteger(Rgb), nChannel = 1;
+    int order = (rgb ? GIF_ROWS : (Rf_asInteger(Flip) ? GIF_FLIPPED : GIF_COLUMNS));
+    SEXPTYPE type = (Rf_asInteger(Raw) ? RAWSXP : INTSXP);
+    GifIndex local, *index;
+    SEXP Ret, Image, Map;
+  
+    if (rgb && type==RAWSXP) nChannel = 4;
+    PROTECT(Map = Rf_allocVector(INTSXP, 256));
+    if (TYPEOF(filename)==EXTPTRSXP) {  // file was already indexed by gifindex
+      index = (GifIndex*) R_ExternalPtrAddr(filename);
+      if (!index) Rf_error("read.gif: GIF index is no longer valid");
+      filesize = index->nByte;
+    } else {
+      index    = &local;
+      filesize = GifScan(CHAR(STRING_ELT(filename, 0)), Rf_asInteger(Verbose)!=0, index);
     }
-    if(comment) R_Free(comment);
-    UNPROTECT(1);
+    if (filesize<0) {                   // file not found or not a GIF file
+      stats = -filesize;
+      memcpy(INTEGER(Map), index->ColorMap, 256*sizeof(int));
+    } else stats = GifSelectFrames(index, Rf_asInteger(NImage), iFirst, nFrame, 
+                                   INTEGER(Map), transparent);
+    
+    if (nFrame) {
+      nRow = index->Frame[iFirst].Height;
+      nCol = index->Frame[iFirst].Width;
+      if (order==GIF_FLIPPED) { int n=nRow; nRow=nCol; nCol=n; }
+      if (nChannel>1) { int n=nRow; nRow=nCol; nCol=n; } // [channel, col, row]
+      PROTECT(Image = AllocImage(type, nChannel, nRow, nCol, nFrame));
+      if (type==RAWSXP) nGood = GifDecodeFrames   (index, iFirst, nFrame, RAW(Image), order, nChannel);
+      else              nGood = GifDecodeFramesInt(index, iFirst, nFrame, INTEGER(Image), order, rgb!=0);
+      if (nGood<nFrame) {               // DecodeLZW exit without finding file terminator
+        if (stats%6==0) stats+=4;       // unless other error was already found
+        if (nGood+1<nFrame) {           // keep the corrupted frame, drop the rest
+          nFrame = nGood+1;
+          SEXP Image2 = AllocImage(type, nChannel, nRow, nCol, nFrame);
+          size_t n = (size_t) nChannel*nRow*nCol*nFrame;
+          if (type==RAWSXP) memcpy(RAW(Image2), RAW(Image), n);
+          else memcpy(INTEGER(Image2), INTEGER(Image), n*sizeof(int));
+          UNPROTECT(1);
+          PROTECT(Image = Image2);
+        }
+      }
+      if (rgb && type==INTSXP && nFrame==1) { // single frame: mark it as native raster
+        Rf_setAttrib(Image, R_ClassSymbol, Rf_mkString("nativeRaster"));
+        Rf_setAttrib(Image, Rf_install("channels"), Rf_ScalarInteger(4));
+      }
+    } else PROTECT(Image = Rf_allocVector(type, 0));
+    
+    PROTECT(Ret = Rf_allocVector(VECSXP, 5));
+    SET_VECTOR_ELT(Ret, 0, Image);
+    SET_VECTOR_ELT(Ret, 1, Map);
+    SET_VECTOR_ELT(Ret, 2, Rf_ScalarInteger(transparent));
+    if (index->Comment && strlen(index->Comment)) 
+      SET_VECTOR_ELT(Ret, 3, Rf_mkString(index->Comment));
+    SET_VECTOR_ELT(Ret, 4, Rf_ScalarInteger(stats ? -stats : filesize));
+    if (index==&local) GifFreeIndex(index);
+    UNPROTECT(3);
     return Ret;
   }
+  
+  //------------------------------------------------------------------
+  // Frame index of a GIF file kept in an external pointer
+  //------------------------------------------------------------------
+  
+  static void gifindexfinalize(SEXP Ptr)
+  {
+    GifIndex* index = (GifIndex*) R_ExternalPtrAddr(Ptr);
+    if (index) {
+      GifFreeIndex(index);
+      R_Free(index);
+    }
+    R_ClearExternalPtr(Ptr);
+  }
+  
+  SEXP gifindex(SEXP filename, SEXP Verbose)
+  { // returns list(external pointer, frame info matrix, status)
+    int i, nFrame, filesize, *info;
+    GifIndex* index = R_Calloc(1, GifIndex);
+    GifFrame* frame;
+    SEXP Ret, Ptr, Info;
+    
+    filesize = GifScan(CHAR(STRING_ELT(filename, 0)), Rf_asInteger(Verbose)!=0, index);
+    if (filesize<0) {                   // file not found or not a GIF file
+      R_Free(index);
+      index = NULL;
+    }
+    nFrame = (index ? index->nFrame : 0);
+    PROTECT(Ret  = Rf_allocVector(VECSXP, 3));
+    PROTECT(Info = Rf_allocMatrix(INTSXP, nFrame, 9));
+    info = INTEGER(Info);
+    for (i=0; i<nFrame; i++) {
+      frame = index->Frame+i;
+      info[i         ] = frame->Left;
+      info[i+  nFrame] = frame->Top;
+      info[i+2*nFrame] = frame->Width;
+      info[i+3*nFrame] = frame->Height;
+      info[i+4*nFrame] = frame->Interlace;
+      info[i+5*nFrame] = frame->DelayTime;
+      info[i+6*nFrame] = frame->Transparent;
+      info[i+7*nFrame] = frame->Disposal;
+      info[i+8*nFrame] = frame->nColor;
+    }
+    if (index) {
+      PROTECT(Ptr = R_MakeExternalPtr(index, Rf_install("GifIndex"), R_NilValue));
+      R_RegisterCFinalizerEx(Ptr, gifindexfinalize, TRUE);
+      SET_VECTOR_ELT(Ret, 0, Ptr);
+      UNPROTECT(1);
+      if (index->stats) filesize = -index->stats;
+    }
+    SET_VECTOR_ELT(Ret, 1, Info);
+    SET_VECTOR_ELT(Ret, 2, Rf_ScalarInteger(filesize));
+    UNPROTECT(2);
+    return Ret;
+  }
+  
+  //------------------------------------------------------------------
+  // Streaming GIF writer kept in an external pointer
+  //------------------------------------------------------------------
+  
+  static void gifwriterfinalize(SEXP Ptr)
+  { // close the file if user forgot to, so it is still a valid GIF file
+    GifWriter* gif = (GifWriter*) R_ExternalPtrAddr(Ptr);
+    if (gif) GifWriterClose(gif);
+    R_ClearExternalPtr(Ptr);
+  }
+  
+  SEXP gifopen(SEXP filename, SEXP Param, SEXP ColorMap, SEXP Comment)
+  {
+    int *param = INTEGER(Param); // nRow, nCol, nColor, transparent, delay, interlace
+    GifWriter* gif;
+    SEXP Ptr;
+    gif = GifWriterOpen(CHAR(STRING_ELT(filename, 0)), param[0], param[1], param[2], 
+                        INTEGER(ColorMap), param[5]!=0, param[3], param[4], 
+                        (char*) CHAR(STRING_ELT(Comment, 0)));
+    if (!gif) Rf_error("gif.open: cannot open the output file (connection)");
+    PROTECT(Ptr = R_MakeExternalPtr(gif, Rf_install("GifWriter"), R_NilValue));
+    R_RegisterCFinalizerEx(Ptr, gifwriterfinalize, TRUE);
+    UNPROTECT(1);
+    return Ptr;
+  }
+  
+  SEXP gifaddframe(SEXP Ptr, SEXP Data)
+  {
+    int i, nFrame, nPixel = LENGTH(Data), *Frame = INTEGER(Data);
+    GifWriter* gif = (GifWriter*) R_ExternalPtrAddr(Ptr);
+    if (!gif) Rf_error("gif.add.frame: GIF file was already closed");
+    if (nPixel!=GifWriterPixels(gif)) 
+      Rf_error("gif.add.frame: size of the frame differs from the one given to gif.open");
+    for(i=0; i<nPixel; i++)               // NA_INTEGER is negative too
+      if (Frame[i]<0 || Frame[i]>255) 
+        Rf_error("gif.add.frame: pixel values outside of the color palette");
+    uchar* data = R_Calloc(nPixel, uchar);
+    for(i=0; i<nPixel; i++) data[i] = static_cast<uchar>(Frame[i]);
+    nFrame = GifWriterAdd(gif, data);
+    R_Free(data);
+    if (nFrame<0) Rf_error("gif.add.frame: pixel values outside of the color palette");
+    return Rf_ScalarInteger(nFrame);
+  }
+  
+  SEXP gifclose(SEXP Ptr)
+  {
+    int filesize = 0;
+    GifWriter* gif = (GifWriter*) R_ExternalPtrAddr(Ptr);
+    if (gif) filesize = GifWriterClose(gif);
+    R_ClearExternalPtr(Ptr);
+    return Rf_ScalarInteger(filesize);
+  }
 
 }
@@ -0,0 +1,294 @@
+/*===========================================================================*/
+/* GifQuant - color quantization for GIF encoder                             */
+/* Copyright (C) 2005 Jarek Tuszynski                                        */
+/* Distributed under GNU General Public License version 3                    */
+/*===========================================================================*/
+/*                                                                           */
+/* Converts true-color images to at most 256 color palette and to indices    */
+/* into that palette, which can be than passed to imwriteGif.                */
+/* Colors are stored as integers in 0xRRGGBB format, negative numbers mark   */
+/* transparent pixels.                                                       */
+/*===========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>   // memset, memcpy
+#include "GifTools.h"
+
+#define QBIT  5                        // bits per channel used by color histogram
+#define QSIZE (1<<(3*QBIT))            // number of histogram bins
+#define RED(c)   (((c)>>16) & 0xff)
+#define GREEN(c) (((c)>> 8) & 0xff)
+#define BLUE(c)  ( (c)      & 0xff)
+#define QBIN(r,g,b) ( (((r)>>(8-QBIT))<<(2*QBIT)) | (((g)>>(8-QBIT))<<QBIT) | ((b)>>(8-QBIT)) )
+
+//==============================================================
+// Palette design
+//==============================================================
+
+//------------------------------------------------------------------
+// Collects distinct colors of the image, gives up as soon as there
+// are more than nColor of them.
+// returns:   number of distinct colors or -1 if there are too many
+//------------------------------------------------------------------
+int ExactColors(const int *rgb, long nPixel, int nColor, int *ColorMap)
+{
+  int table[1024], i, j, n=0;   // hash table large enough for 256 colors
+  long k;
+  memset(table, -1, 1024*sizeof(int));
+  for (k=0; k<nPixel; k++) {
+    if (rgb[k]<0) continue;     // skip transparent pixels
+    j = ((rgb[k]*2654435761u)>>22) & 1023;
+    while (table[j]>=0 && table[j]!=rgb[k]) j = (j+1) & 1023;
+    if (table[j]==rgb[k]) continue;
+    if (n==nColor) return -1;
+    table[j] = ColorMap[n++] = rgb[k];
+  }
+  for (i=0; i<n; i++)           // insertion sort: keep palette ordered
+    for (j=i; j>0 && ColorMap[j-1]>ColorMap[j]; j--) {
+      k = ColorMap[j]; ColorMap[j] = ColorMap[j-1]; ColorMap[j-1] = (int) k;
+    }
+  return n;
+}
+
+//------------------------------------------------------------------
+// Box in the color histogram used by median cut algorithm
+//------------------------------------------------------------------
+typedef struct {
+  int    lo[3], hi[3];          // range of histogram bins along r, g & b axis
+  double count;                 // number of pixels inside the box
+} ColorBox;
+
+void ShrinkBox(ColorBox *box, const double *hist)
+{ // shrink box to the smallest one containing all of its pixels
+  int i, c[3], lo[3]={QSIZE,QSIZE,QSIZE}, hi[3]={-1,-1,-1};
+  box->count = 0;
+  for (c[0]=box->lo[0]; c[0]<=box->hi[0]; c[0]++)
+    for (c[1]=box->lo[1]; c[1]<=box->hi[1]; c[1]++)
+      for (c[2]=box->lo[2]; c[2]<=box->hi[2]; c[2]++) {
+        double h = hist[(c[0]<<(2*QBIT)) | (c[1]<<QBIT) | c[2]];
+        if (h==0) continue;
+        box->count += h;
+        for (i=0; i<3; i++) {
+          if (c[i]<lo[i]) lo[i]=c[i];
+          if (c[i]>hi[i]) hi[i]=c[i];
+        }
+      }
+  if (box->count>0)
+    for (i=0; i<3; i++) { box->lo[i]=lo[i]; box->hi[i]=hi[i]; }
+}
+
+//------------------------------------------------------------------
+// Splits box along its longest axis at the median pixel
+//------------------------------------------------------------------
+void SplitBox(ColorBox *box, ColorBox *box2, const double *hist)
+{
+  int axis=0, i, c[3], len=-1, shift[3] = {2*QBIT, QBIT, 0};
+  double slice[1<<QBIT], sum=0;
+  for (i=0; i<3; i++)
+    if (box->hi[i]-box->lo[i]>len) { len=box->hi[i]-box->lo[i]; axis=i; }
+  memset(slice, 0, (1<<QBIT)*sizeof(double));
+  for (c[0]=box->lo[0]; c[0]<=box->hi[0]; c[0]++)
+    for (c[1]=box->lo[1]; c[1]<=box->hi[1]; c[1]++)
+      for (c[2]=box->lo[2]; c[2]<=box->hi[2]; c[2]++)
+        slice[c[axis]] += hist[(c[0]<<shift[0]) | (c[1]<<shift[1]) | c[2]];
+  // find the median, but leave at least one slice for each box
+  for (i=box->lo[axis]; i<box->hi[axis]-1; i++) {
+    sum += slice[i];
+    if (2*sum>=box->count) break;
+  }
+  *box2 = *box;
+  box ->hi[axis] = i;
+  box2->lo[axis] = i+1;
+  ShrinkBox(box , hist);
+  ShrinkBox(box2, hist);
+}
+
+//------------------------------------------------------------------
+// Designs palette of at most nColor colors for nPixel pixels of 'rgb'.
+// Images with no more than nColor distinct colors get them all.
+// Otherwise median cut algorithm is used: histogram of colors (build in
+// parallel over image tiles) is recursively split into boxes with equal
+// number of pixels and each box is represented by the mean of its pixels.
+// returns:   number of colors in ColorMap
+//------------------------------------------------------------------
+int QuantizeColors(const int *rgb, long nPixel, int nColor, int *ColorMap)
+{
+  int i, j, k, nBox, shift[3] = {16, 8, 0};
+  long t, nTile, tile = 1<<16;
+  double *hist, *sum, best;
+  ColorBox box[256];
+
+  if (nColor>256) nColor = 256;
+  if (nColor<1) return 0;
+  nBox = ExactColors(rgb, nPixel, nColor, ColorMap);
+  if (nBox>=0) return nBox;
+
+  //====================================
+  // build color histogram and sums of pixel values in each bin
+  //====================================
+  hist = new double[4*QSIZE];   // count, red, green & blue sums
+  sum  = hist + QSIZE;
+  memset(hist, 0, 4*QSIZE*sizeof(double));
+  nTile = (nPixel+tile-1)/tile;
+  #pragma omp parallel private(t, i)
+  {
+    double *h = new double[4*QSIZE];
+    memset(h, 0, 4*QSIZE*sizeof(double));
+    #pragma omp for schedule(static)
+    for (t=0; t<nTile; t++) {
+      long k, kEnd = (t+1)*tile < nPixel ? (t+1)*tile : nPixel;
+      for (k=t*tile; k<kEnd; k++) {
+        int c = rgb[k];
+        if (c<0) continue;        // skip transparent pixels
+        int bin = QBIN(RED(c), GREEN(c), BLUE(c));
+        h[bin]++;
+        h[  QSIZE+bin] += RED  (c);
+        h[2*QSIZE+bin] += GREEN(c);
+        h[3*QSIZE+bin] += BLUE (c);
+      }
+    }
+    #pragma omp critical
+    for (i=0; i<4*QSIZE; i++) hist[i] += h[i];
+    delete []h;
+  }
+
+  //====================================
+  // median cut: split the most populated box until there are enough
+  //====================================
+  box[0].lo[0] = box[0].lo[1] = box[0].lo[2] = 0;
+  box[0].hi[0] = box[0].hi[1] = box[0].hi[2] = (1<<QBIT)-1;
+  ShrinkBox(box, hist);
+  for (nBox=1; nBox<nColor; nBox++) {
+    for (best=0, j=-1, i=0; i<nBox; i++)
+      if (box[i].count>best && (box[i].lo[0]<box[i].hi[0] ||
+          box[i].lo[1]<box[i].hi[1] || box[i].lo[2]<box[i].hi[2]))
+      { best=box[i].count; j=i; }
+    if (j<0) break;             // no box can be split any more
+    SplitBox(box+j, box+nBox, hist);
+  }
+
+  //====================================
+  // each box is represented by the mean of its pixels
+  //====================================
+  for (i=0; i<nBox; i++) {
+    double s[3]={0,0,0}, n=0;
+    int c[3];
+    for (c[0]=box[i].lo[0]; c[0]<=box[i].hi[0]; c[0]++)
+      for (c[1]=box[i].lo[1]; c[1]<=box[i].hi[1]; c[1]++)
+        for (c[2]=box[i].lo[2]; c[2]<=box[i].hi[2]; c[2]++) {
+          int bin = (c[0]<<(2*QBIT)) | (c[1]<<QBIT) | c[2];
+          n += hist[bin];
+          for (k=0; k<3; k++) s[k] += sum[k*QSIZE+bin];
+        }
+    ColorMap[i] = 0;
+    for (k=0; k<3; k++) ColorMap[i] |= ((int) (s[k]/(n>0 ? n : 1) + 0.5)) << shift[k];
+  }
+  delete []hist;
+  return nBox;
+}
+
+//==============================================================
+// Pixel mapping
+//==============================================================
+
+inline int Nearest(int r, int g, int b, const int *ColorMap, int nColor)
+{ // index of palette color closest to (r,g,b) in Euclidean distance
+  int i, d, dr, dg, db, best=0, dMin=1<<30;
+  for (i=0; i<nColor; i++) {
+    dr = r - RED  (ColorMap[i]);
+    dg = g - GREEN(ColorMap[i]);
+    db = b - BLUE (ColorMap[i]);
+    d  = dr*dr + dg*dg + db*db;
+    if (d<dMin) { dMin=d; best=i; }
+  }
+  return best;
+}
+
+inline int Lookup(int c, const unsigned int *sorted, int nColor, const uchar *inverse)
+{ // palette index of color c: exact match if there is one, otherwise the
+  // color nearest to the center of c's histogram bin
+  int lo=0, hi=nColor-1, mid;
+  unsigned int key = static_cast<unsigned int>(c);
+  while (lo<=hi) {
+    mid = (lo+hi)>>1;
+    if      ((sorted[mid]>>8)<key) lo = mid+1;
+    else if ((sorted[mid]>>8)>key) hi = mid-1;
+    else return sorted[mid] & 0xff;
+  }
+  return inverse[QBIN(RED(c), GREEN(c), BLUE(c))];
+}
+
+inline int Clip(float x) { return (x<0 ? 0 : (x>255 ? 255 : static_cast<int>(x+0.5f))); }
+
+//------------------------------------------------------------------
+// Maps nBand frames of true color pixels 'rgb' (each Width x Height) to
+// indices of the nColor colors of ColorMap. Transparent pixels are set to
+// 'transparent'. Optionally errors are diffused to neighboring pixels using
+// Floyd-Steinberg dithering, in which case each frame is processed by a
+// single thread; otherwise pixels are processed by many threads.
+//------------------------------------------------------------------
+void MapColors(const int *rgb, int Width, int Height, int nBand,
+               const int *ColorMap, int nColor, bool dither, int transparent,
+               uchar *data)
+{
+  int i, band;
+  long k, nPixel = (long) Width*Height*nBand;
+  unsigned int sorted[256];     // palette sorted by color, with index in low byte
+  uchar *inverse = new uchar[QSIZE];
+
+  for (i=0; i<nColor; i++) {
+    unsigned int key = (static_cast<unsigned int>(ColorMap[i])<<8) | i;
+    int j;
+    for (j=i; j>0 && sorted[j-1]>key; j--) sorted[j] = sorted[j-1];
+    sorted[j] = key;
+  }
+  #pragma omp parallel for schedule(static)
+  for (i=0; i<QSIZE; i++) {     // nearest palette color to each bin center
+    int half = 1<<(7-QBIT);
+    inverse[i] = static_cast<uchar>(Nearest(
+      ((i>>(2*QBIT))           <<(8-QBIT)) + half,
+      (((i>>QBIT)&((1<<QBIT)-1))<<(8-QBIT)) + half,
+      ((i       &((1<<QBIT)-1))<<(8-QBIT)) + half, ColorMap, nColor));
+  }
+
+  if (!dither) {
+    #pragma omp parallel for schedule(static)
+    for (k=0; k<nPixel; k++)
+      data[k] = static_cast<uchar>(rgb[k]<0 ? transparent : Lookup(rgb[k], sorted, nColor, inverse));
+    delete []inverse;
+    return;
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (band=0; band<nBand; band++) {
+    int row, col, c, idx, v[3];
+    float e[3], *cur  = new float[6*(Width+2)], *next = cur+3*(Width+2), *tmp;
+    const int *in = rgb + (long) band*Width*Height;
+    uchar *out = data + (long) band*Width*Height;
+    memset(cur, 0, 6*(Width+2)*sizeof(float));
+    for (row=0; row<Height; row++) {
+      for (col=0; col<Width; col++, in++, out++) {
+        if (*in<0) { *out = static_cast<uchar>(transparent); continue; }
+        float *p = cur + 3*(col+1);   // error diffused to this pixel
+        v[0] = Clip(RED  (*in) + p[0]);
+        v[1] = Clip(GREEN(*in) + p[1]);
+        v[2] = Clip(BLUE (*in) + p[2]);
+        idx  = Lookup((v[0]<<16) | (v[1]<<8) | v[2], sorted, nColor, inverse);
+        *out = static_cast<uchar>(idx);
+        e[0] = static_cast<float>(v[0] - RED  (ColorMap[idx]));
+        e[1] = static_cast<float>(v[1] - GREEN(ColorMap[idx]));
+        e[2] = static_cast<float>(v[2] - BLUE (ColorMap[idx]));
+        for (c=0; c<3; c++) {
+          p   [c+3] += e[c]*(7.0f/16);  // right
+          next[3*col+c] += e[c]*(3.0f/16);  // bottom left
+          next[3*col+c+3] += e[c]*(5.0f/16);  // bottom
+          next[3*col+c+6] += e[c]*(1.0f/16);  // bottom right
+        }
+      }
+      tmp = cur; cur = next; next = tmp;
+      memset(next, 0, 3*(Width+2)*sizeof(float));
+    }
+    delete [](cur<next ? cur : next);
+  }
+  delete []inverse;
+}
@@ -8,6 +8,9 @@
 #include <stdlib.h>
 #include <string.h>   // memset, memcpy
 #include "GifTools.h"   
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 typedef unsigned char uchar;
 
 #ifndef USING_R // if not using R language than define following calls:
@@ -39,6 +42,71 @@ inline void Error(char *message) { fprintf(stderr, "\nError: %s.\n", message); e
 
 inline int bitGet (int  num, int bit) { return ((num &  (1<<bit)) !=0 ); } 
 
+inline int GifThreads()
+{ // number of threads available for frame level parallelism
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+//==============================================================
+// Output byte stream: either a binary file or a growing memory 
+// buffer, so that frames can be compressed independently of each
+// other and of the file they will end up in.
+//==============================================================
+class GifOutput {
+public:
+  
+  GifOutput(FILE *bf=NULL) 
+  { // Constructor
+    binfile = bf;
+    buffer  = NULL;
+    nByte   = nAlloc = 0;
+  }
+  ~GifOutput() { if (buffer) delete []buffer; }
+  
+  int   Size() { return nByte; }
+  uchar* Data() { return buffer; }
+  void  Clear() { nByte = 0; }
+  
+  void Put(int c)
+  { 
+    if (binfile) fputc(c, binfile);
+    else {
+      if (nByte==nAlloc) Grow(1);
+      buffer[nByte++] = static_cast<uchar>(c);
+    }
+  }
+  
+  void Write(const uchar *p, int n)
+  { 
+    if (binfile) fwrite(p, n, 1, binfile);
+    else {
+      if (nByte+n>nAlloc) Grow(n);
+      memcpy(buffer+nByte, p, n);
+      nByte += n;
+    }
+  }
+  
+private:
+  void Grow(int n)
+  { // at least double the buffer to keep the number of copies low
+    nAlloc = (nByte+n > 2*nAlloc ? nByte+n : 2*nAlloc) + 1024;
+    uchar *p = new uchar[nAlloc];
+    if (buffer) {
+      memcpy(p, buffer, nByte);
+      delete []buffer;
+    }
+    buffer = p;
+  }
+  
+  FILE  *binfile;    // if set than all output goes directly to the file
+  uchar *buffer;     // otherwise it is accumulated in memory 
+  int    nByte, nAlloc;
+}; // class GifOutput
+
 //==============================================================
 // bit-packer class
 //==============================================================
@@ -68,6 +136,7 @@ public:
   BitPacker()
   { // Constructor
     binfile   = NULL;
+    out       = NULL;
     need      = 8;
     pos       = buffer;
     *pos      = 0;
@@ -78,6 +147,7 @@ public:
   
   int  BytesDone() { return bytesdone; }
   void GetFile(FILE *bf) { binfile = bf; }
+  void SetOutput(GifOutput *bo) { out = bo; }
   
   //------------------------------------------------------------------------- 
   
@@ -108,11 +178,11 @@ public:
       *pos += static_cast<uchar>((mask&code)<<(8-need));
       need -= nBits;                         
     }    
-    // As soon as 255 bytes are full, they are written to 'binfile' as a 
+    // As soon as 255 bytes are full, they are written to 'out' as a 
     // data block and removed from 'buffer'.
     if(pos-buffer >= 255) {         // pos pointing to buffer[255] or beyond
-      fputc(255,binfile);           // write the "bytecount-byte"
-      fwrite(buffer,255,1,binfile); // write buffer[0..254] to file
+      out->Put(255);                // write the "bytecount-byte"
+      out->Write(buffer,255);       // write buffer[0..254] to file
       buffer[0] = buffer[255];      // rotate the following bytes, which may still 
       buffer[1] = buffer[256];      // contain data, to the beginning of buffer, 
       pos -= 255;                   // point pos to the position for new input
@@ -130,8 +200,8 @@ public:
     if(need<8) pos++;  // close any partially filled terminal byte
     int BlockSize = static_cast<int>(pos-buffer);   // # remaining bytes
     if(BlockSize>0) { // buffer is empty
-      fputc(BlockSize, binfile);
-      fwrite(buffer, BlockSize, 1, binfile);
+      out->Put(BlockSize);
+      out->Write(buffer, BlockSize);
       bytesdone += BlockSize+1;
     }
   } // BitPacker::WriteFlush
@@ -140,7 +210,7 @@ public:
   
   short GetCode(short nBits)
   // Extract nBits [1:32] integer from the buffer. 
-  // Read next data block if needed.
+  // Read next data block if needed. Returns -1 if data ended prematurely.
   {
     short i, j, code, lastbit;
     // if more bits is needed than we have stored in the buffer
@@ -150,6 +220,10 @@ public:
       buffer[1] = buffer[BlockSize+1];
       curbit   -= BlockSize<<3; 
       BlockSize = GetDataBlock(binfile, &buffer[2]);
+      if (BlockSize<=0) {           // terminator block or EOF: no more codes
+        BlockSize = 0;
+        return -1;
+      }
       lastbit   = (2+BlockSize)<<3; // (BlockSize<<3 == BlockSize*8) - byte to bit conversion
       bytesdone += BlockSize+1;     // keep track of number of bytes read
     }
@@ -172,7 +246,8 @@ public:
   }
   
 private:
-  FILE  *binfile;
+  FILE  *binfile;      // input file used by GetCode
+  GifOutput *out;      // output stream used by SubmitCode
   uchar  buffer[260];  // holds the total buffer of 256 + some extra
   uchar *pos;          // sliding pointer into buffer
   uchar  need;         // [1..8] tells how many bits will still fit in current byte
@@ -185,6 +260,65 @@ private:
 // Gif-compression de compression functions
 //==============================================================
 
+//=======================================================================
+// Order of rows in the "raster data" section: top to bottom or, in case of
+// interlaced images, in 4 passes: every 8th row starting with row 0, every 
+// 8th row starting with row 4, every 4th starting with row 2 and every 2nd 
+// starting with row 1. Rows are visited in place, without reordering copies.
+//=======================================================================
+class RowOrder {
+public:
+  RowOrder(int Height, bool interlace) 
+  { 
+    this->Height    = Height;
+    this->Interlace = interlace;
+    pass = 0;
+  }
+  
+  int Next(int row)
+  { // row stored after 'row' or Height if none
+    static const int start[4]={0,4,2,1}, step[4]={8,8,4,2};
+    if (!Interlace) return row+1;
+    for (row+=step[pass]; row>=Height && pass<3; ) row = start[++pass];
+    return (row<Height ? row : Height);
+  }
+  
+private:
+  int  Height, pass;
+  bool Interlace;
+}; // class RowOrder
+
+//=======================================================================
+// Supplies pixels of Width x Height image to the encoder in file order
+//=======================================================================
+class PixelSource {
+public:
+  PixelSource(const uchar *data, int Width, int Height, bool interlace) 
+    : rows(Height, interlace)
+  {
+    this->data  = data;
+    this->Width = Width;
+    p = data;
+    x = y = 0;
+  }
+  
+  inline uchar Get()
+  { // return next pixel
+    uchar c = *p++;
+    if (++x==Width) {
+      x = 0;
+      y = rows.Next(y);
+      p = data + (long) y*Width;
+    }
+    return c;
+  }
+  
+private:
+  RowOrder rows;
+  const uchar *data, *p;  // image and current pixel
+  int Width, x, y;
+}; // class PixelSource
+
 //===========================================================================
 // Contains the string-table, generates compression codes and writes them to a
 // binary file, formatted in data blocks of maximum length 255 with
@@ -193,19 +327,18 @@ private:
 // file, consisting of the "code size" byte followed by the counter-headed
 // data blocks, including the terminating zero block.
 // bf         must be an opened binary file to which the preceding parts
-//            of the GIF format have been written
-// data       is an array of bytes containing one pixel each and sorted
-//            left to right, top to bottom. The first pixel is in data[0]
+//            of the GIF format have been written, or a memory buffer
+// src        supplies pixels one at a time, in the order they are stored
 // nPixel     Number of pixels in the image
 // nBit       Number of bits per pixel, where 2^nBit is the size of the GIF's
 //            color tables. Allowed are 1..8. Used to determine 'nbits' and
 //            the number of root codes. Max(data) HAS to be < 2^nBits
 // returns:   The total number of bytes that have been written.
 //------------------------------------------------------------------------- 
-int EncodeLZW(FILE *bf, const uchar *data, int nPixel, short nBits)
+int EncodeLZW(GifOutput *bf, PixelSource &src, long nPixel, short nBits)
 {
   BitPacker bp;          // object that does the packing and writing of the compression codes
-  int    iPixel;         // pixel counter
+  long   iPixel;         // pixel counter
   uchar  pixel;          // next pixel value to be encoded
   short  axon[4096], next[4096];  // arrays making up the string-table
   uchar  pix[4096];      // dito
@@ -222,14 +355,14 @@ int EncodeLZW(FILE *bf, const uchar *data, int nPixel, short nBits)
   // initialize pixel reader
   nBits  = depth+1;      // current length of compression codes in bits [2, 12] (changes during encoding process)
   iPixel = 0;            // pixel #1 is next to be processed (iPixel will be pixel counter)          
-  pixel  = data[iPixel]; // get pixel #1 
+  pixel  = (nPixel ? src.Get() : 0); // get pixel #1 
   // alocate and initialize memory
-  bp.GetFile(bf);  // object packs the code and renders it to the binary file 'bf'
+  bp.SetOutput(bf);  // object packs the code and renders it to the binary file 'bf'
   for(i=0; i<cc; i++) pix[i] = static_cast<uchar>(i); // Initialize the string-table's root nodes  
   
   // Write what the GIF specification calls the "code size". Allowed are [2..8].
   // This is the number of bits required to represent the pixel values. 
-  fputc(depth,bf);             // provide data-depth to the decoder
+  bf->Put(depth);              // provide data-depth to the decoder
   freecode = 4096;             // this will cause string-table flush first time around
   while(iPixel<nPixel) {       // continue untill all the pixels are processed
     if(freecode==(1<<nBits))   // if the latest code added to the string-table exceeds 'nbits' bits:
@@ -250,7 +383,7 @@ int EncodeLZW(FILE *bf, const uchar *data, int nPixel, short nBits)
       up = outlet;
       iPixel++;                   // advance pixel counter (the only place it is advanced)
       if(iPixel >= nPixel) break; // end of data stream ? Terminate
-      pixel = data[iPixel];       // get the value of the next pixel
+      pixel = src.Get();          // get the value of the next pixel
       // Checks if the chain starting from headnode's axon (axon[up]) contains a node for 
       // 'pixel'. Returns that node's address (=outlet), or 0 if there is no such node.
       // 0 cannot be the root node 0, since root nodes occur in no chain.
@@ -279,10 +412,68 @@ int EncodeLZW(FILE *bf, const uchar *data, int nPixel, short nBits)
   // Wrap up the file 
   bp.SubmitCode(eoi,nBits); // submit 'eoi' as the last item of the code stream
   bp.WriteFlush();   // write remaining codes including this 'eoi' to the binary file
-  fputc(0,bf);       // write an empty data block to signal the end of "raster data" section in the file
+  bf->Put(0);        // write an empty data block to signal the end of "raster data" section in the file
   return 2 + bp.BytesDone();
 } // EncodeLZW
 
+int EncodeLZW(GifOutput *bf, const uchar *data, int nPixel, short nBits)
+{ // data is an array of bytes containing one pixel each
+  PixelSource src(data, nPixel, 1, false);
+  return EncodeLZW(bf, src, nPixel, nBits);
+}
+
+int EncodeLZW(FILE *bf, const uchar *data, int nPixel, short nBits)
+{
+  GifOutput out(bf);
+  return EncodeLZW(&out, data, nPixel, nBits);
+}
+
+
+//=======================================================================
+// Destination of decoded pixels. Pixels arrive left to right, in rows 
+// ordered as in the file (see RowOrder) and pixel (x,y) is stored at 
+// data[x*xStep + y*yStep], so that frames can be decoded straight into 
+// final row positions of transposed or flipped arrays of any type.
+// Each color index c is stored as lut[c], which can be the index itself or
+// its color, so colormap lookup happens in the decoding loop.
+//=======================================================================
+template <class T> class PixelSink {
+public:
+  PixelSink(T *data, int Width, int Height, int order, const T *lut, 
+            bool interlace=false) : rows(Height, interlace)
+  {
+    this->lut    = lut;
+    this->Width  = Width;
+    this->Height = Height;
+    switch (order) {
+      case GIF_COLUMNS: xStep = Height; yStep = 1;      base = data; break;
+      case GIF_FLIPPED: xStep = 1;      yStep = -Width; base = data+(long)(Height-1)*Width; break;
+      default:          xStep = 1;      yStep = Width;  base = data;
+    }
+    Row(0);
+  }
+  
+  inline void Put(int c)
+  { // store next pixel
+    *p = lut[c];
+    p += xStep;
+    if (++x==Width) Row(rows.Next(y));
+  }
+  
+  void Row(int row)
+  { // move to the start of given row
+    x = 0;
+    y = row;
+    if (y<Height) p = base + y*yStep;
+  }
+  
+private:
+  RowOrder rows;
+  const T *lut;      // pixel value for each color index
+  T   *base, *p;     // pixel (0,0) and current pixel
+  long xStep, yStep; // distance between pixels in the same row & column
+  int  Width, Height, x, y;
+}; // class PixelSink
 
 //------------------------------------------------------------------------- 
 // Reads the "raster data"-section of the GIF file and decodes the pixel 
@@ -290,22 +481,23 @@ int EncodeLZW(FILE *bf, const uchar *data, int nPixel, short nBits)
 // handles interlace row irdering
 // bf         must be an opened binary file to which the preceding parts
 //            of the GIF format have been written
-// data       is an array of bytes containing one pixel each and sorted
-//            left to right, top to bottom. 
+// out        receives decoded pixels, which are sorted left to right, top to 
+//            bottom. 
 // nPixels    Number of pixels in the image
 // returns:   The total number of bytes that have been written.
 //------------------------------------------------------------------------- 
-int DecodeLZW(FILE *fp, uchar *data, int nPixel)
+template <class Sink> int DecodeLZW(FILE *fp, Sink &out, long nPixel)
 {
   BitPacker bp;                 // object that does the packing and writing of the
   short cc, eoi, freecode, nBits, depth, nStack, code, incode, firstcode, oldcode;
   short pix[4096], next[4096];
   uchar stack[4096];
-  int iPixel, ret;
+  long iPixel;
+  int ret;
   
   freecode=nBits=firstcode=oldcode=0; // unnecesary line used to prevent warnings in gcc
   depth = fgetc(fp);             // number of bits per data item (=pixel). Remains unchanged.
-  if (depth==EOF) return -1;
+  if (depth==EOF || depth<1 || depth>8) return 0; // error
   bp.GetFile(fp);                // object packs the code and renders it to the binary file 'bf'
   cc    = 1<<depth;              // 'cc' or 'clear-code' Signals the clearing of the string-table.
   eoi   = cc+1;                  // 'end-of-information'-code must be the last item of the code stream
@@ -322,8 +514,11 @@ int DecodeLZW(FILE *fp, uchar *data, int nPixel)
       nBits    = depth+1;
       freecode = cc+2;
       do { firstcode = bp.GetCode(nBits); } while (firstcode==cc); // keep on flushing until a non cc entry
+      if (firstcode == eoi) break;
+      if (firstcode<0 || firstcode>cc) return 0; // error: truncated data or undefined code
       oldcode = firstcode;
-      data[iPixel++] = static_cast<uchar>(firstcode);
+      out.Put(firstcode);
+      iPixel++;
     } else {                     // the regular case
       nStack = 0;                // (re)initialize the stack    
       incode = code;             // store a copy of the code - it will be needed 
@@ -337,14 +532,15 @@ int DecodeLZW(FILE *fp, uchar *data, int nPixel)
         code            = next[code];
       }
       firstcode      = pix[code];
-      data[iPixel++] = static_cast<uchar>(pix[code]);
-      while (nStack && iPixel<nPixel) 
-        data[iPixel++] = stack[--nStack]; // if there is data on the stack return it
+      out.Put(pix[code]);
+      iPixel++;
+      for (; nStack && iPixel<nPixel; iPixel++) 
+        out.Put(stack[--nStack]); // if there is data on the stack return it
       if (freecode<4096) {       // free code is smaller than 2^12 the largest allowed
         next[freecode] = oldcode;// add to string-table
         pix [freecode] = firstcode;
         freecode++;
-        if(freecode==(1<<nBits)) // if the latest code added to the string-table exceeds 'nbits' bits:
+        if(freecode==(1<<nBits) && nBits<12) // if the latest code added to the string-table exceeds 'nbits' bits:
           nBits++;               // increase size of compression codes by 1 bit     
       }
       oldcode = incode;
@@ -367,42 +563,129 @@ inline void fputw(int w, FILE *fp)
   fputc( (w>>8) & 0xff, fp );
 }
 
+//------------------------------------------
+// Encodes raster data of a single image, reading rows in interlace order
 //------------------------------------------
 
+int EncodeImage(GifOutput *out, const uchar* p, int Width, int Height, 
+                bool interlace, int BitsPerPixel)
+{
+  PixelSource src(p, Width, Height, interlace);
+  return EncodeLZW(out, src, (long) Width*Height, BitsPerPixel);
+}
 
-int imwriteGif(const char* filename, const uchar* data, int nRow, int nCol, int nBand, int nColor, 
-               const int *ColorMap,  bool interlace, int transparent, int DalayTime, char* comment)
+//------------------------------------------
+// Frame differencing used to optimize animations. Each frame is compared 
+// with the previous one and only the bounding box of the changed pixels is
+// stored, on top of the previous frame (disposal method 1). Unchanged 
+// pixels within the box are set to 'key' color, which is transparent. 
+// A frame in which some pixels become transparent has to be stored whole 
+// on top of the background, so the previous frame is stored whole too and 
+// has to be cleared after display (disposal method 2). 
+//------------------------------------------
+
+typedef struct {
+  int  Left, Top, Width, Height; // position of the stored sub-image
+  int  Disposal;                 // what to do with the frame after display
+  int  Transparent;              // transparent color or -1
+  bool Diff;                     // is it a difference with previous frame?
+} GifRect;
+
+void DiffFrames(const uchar* data, int Width, int Height, int Bands, 
+                int transparent, int key, GifRect *rect)
 {
-  int B, i, rgb, imMax, filesize=0, Bands, band, n, m;
-  int BitsPerPixel=0, ColorMapSize, Width, Height, nPixel;
-  char fname[256], sig[16], *q;
-  const uchar *p=data;
+  int band, j;
+  long nPixel = (long) Width*Height;
+  bool *clear = new bool[Bands];
   
-  strcpy(fname,filename);
-  i = static_cast<int>(strlen(fname));
-  if (fname[i-4]=='.') strcpy(strrchr(fname,'.'),".gif");
-  Width  = nCol;
-  Height = nRow;
-  Bands  = nBand;
-  nPixel = Width*Height;
-  imMax  = data[0];
-  n = nPixel*nBand;
-  for(i=0; i<n; i++, p++) if(imMax<*p) imMax=*p;
-  nColor=(nColor>256 ? 256 : nColor);     // is a power of two between 2 and 256 compute its exponent BitsPerPixel (between 1 and 8)
-  if (!nColor) nColor = imMax+1;
-  if (imMax>nColor)
-    Error("ImWriteGif: Higher pixel values than size of color table");
-  for(i=1; i<nColor; i*=2) BitsPerPixel++;  
-  if (BitsPerPixel==0) BitsPerPixel=1;
+  #pragma omp parallel for schedule(dynamic)
+  for (band=0; band<Bands; band++) {
+    // frame 0 is displayed after the last one when animation loops
+    const uchar *cur  = data + band*nPixel;
+    const uchar *prev = data + (band ? band-1 : Bands-1)*nPixel;
+    int row, col, Left=Width, Right=-1, Top=Height, Bottom=-1;
+    clear[band] = false;
+    for (row=0; row<Height; row++, cur+=Width, prev+=Width) {
+      if (!memcmp(cur, prev, Width)) continue;  // row did not change
+      for (col=0; col<Width; col++) {
+        if (cur[col]==prev[col]) continue;
+        if (col<Left ) Left  = col;
+        if (col>Right) Right = col;
+        if (cur[col]==transparent) clear[band] = true;
+      }
+      if (Top>row) Top = row;
+      Bottom = row;
+    }
+    rect[band].Disposal = 1;
+    if (band==0) continue;                      // first frame is always whole
+    if (Right<0) Left = Right = Top = Bottom = 0; // no change: store a single pixel
+    rect[band].Left        = Left;
+    rect[band].Top         = Top;
+    rect[band].Width       = Right -Left+1;
+    rect[band].Height      = Bottom-Top +1;
+    rect[band].Transparent = key;
+    rect[band].Diff        = true;
+  }
   
-  FILE *fp = fopen(fname,"wb");
-  if (fp==0) return -1;
+  for (band=0; band<Bands; band++) {
+    if (!clear[band]) continue;
+    if (band) rect[band].Diff = false;          // store this frame whole ...
+    j = (band ? band-1 : Bands-1);              // ... on top of cleared previous one
+    rect[j].Disposal = 2;
+    rect[j].Diff     = false;
+  }
+  for (band=0; band<Bands; band++) 
+    if (!rect[band].Diff) {
+      rect[band].Left = rect[band].Top = 0;
+      rect[band].Width       = Width;
+      rect[band].Height      = Height;
+      rect[band].Transparent = transparent;
+    }
+  delete []clear;
+}
+
+//------------------------------------------
+// Encodes raster data of frame 'band' or its difference with previous frame
+//------------------------------------------
+
+int EncodeFrame(GifOutput *out, const uchar* data, int band, int Width, int Height, 
+                const GifRect *rect, bool interlace, int BitsPerPixel)
+{
+  int row, col, ret, key=rect->Transparent;
+  long nPixel = (long) Width*Height;
+  const uchar *cur = data + band*nPixel, *prev;
+  if (!rect->Diff) return EncodeImage(out, cur, Width, Height, interlace, BitsPerPixel);
+  prev = cur - nPixel;
+  uchar *sub = new uchar[(size_t) rect->Width*rect->Height], *q=sub;
+  for (row=rect->Top; row<rect->Top+rect->Height; row++) {
+    for (col=rect->Left; col<rect->Left+rect->Width; col++, q++) {
+      *q = cur[(long) row*Width+col];
+      if (key>=0 && *q==prev[(long) row*Width+col]) *q = static_cast<uchar>(key);
+    }
+  }
+  ret = EncodeImage(out, sub, rect->Width, rect->Height, interlace, BitsPerPixel);
+  delete []sub;
+  return ret;
+}
+
+//------------------------------------------
+
+//------------------------------------------
+// Writes GIF Signature, Screen Descriptor, Global Color Map and optional 
+// comment and animation extensions. 
+// returns:   The total number of bytes that have been written.
+//------------------------------------------
+
+int WriteGifHeader(FILE *fp, int Width, int Height, int BitsPerPixel, int nColor, 
+                   const int *ColorMap, bool gif89, const char* comment, bool animated)
+{
+  int B, i, rgb, n, m, ColorMapSize, filesize=0;
+  const char *q;
   
   //====================================
   // GIF Signature and Screen Descriptor
   //====================================
-  if (transparent>=0 || comment || Bands>1) strcpy(sig,"GIF89a"); else strcpy(sig,"GIF87a");
-  fwrite( sig, 1, 6, fp );           // Write the Magic header
+  fwrite( gif89 ? "GIF89a" : "GIF87a", 1, 6, fp ); // Write the Magic header
   fputw( Width , fp );               // Bit 1&2 : Logical Screen Width 
   fputw( Height, fp );               // Bit 3&4 : Logical Screen Height 
   B = 0xf0 | (0x7&(BitsPerPixel-1)); // write BitsPerPixel-1 to the three least significant bits of byte 5 
@@ -448,7 +731,7 @@ int imwriteGif(const char* filename, const uchar* data, int nRow, int nCol, int
     fputc( 0, fp );    // extention Block Terminator
     filesize += 3;
   }
-  if (Bands>1) {
+  if (animated) {
     fputc( 0x21, fp ); // GIF Extention Block introducer
     fputc( 0xff, fp ); // byte 2: 255 (hex 0xFF) Application Extension Label
     fputc( 11, fp );   // byte 3: 11 (hex (0x0B) Length of Application Block 
@@ -459,56 +742,212 @@ int imwriteGif(const char* filename, const uchar* data, int nRow, int nCol, int
     fputc( 0, fp );    // extention Block Terminator
     filesize += 19;
   }
+  return filesize + 6 + 7 + 3*ColorMapSize;
+}
+
+//------------------------------------------
+// Writes optional Graphic Control Extension and Image Descriptor of a frame
+// returns:   The total number of bytes that have been written.
+//------------------------------------------
+
+int WriteFrameHeader(FILE *fp, const GifRect *rect, bool control, bool interlace, int DalayTime)
+{
+  int B, filesize=0;
+  if (control) {
+    fputc( 0x21, fp );                // GIF Extention Block introducer "!"
+    fputc( 0xf9, fp );                // "Graphic Control Extension" 
+    fputc( 4, fp );                   // block is of size 4
+    B  = rect->Disposal << 2;         // Disposal Method
+    B |= (0) << 1;                    // User Input flag: is user input needed?
+    B |= (rect->Transparent >= 0 ? 1 : 0);  // Transparency flag
+    fputc( B, fp );                   // "transparency color follows" flag
+    fputw( DalayTime, fp );           // delay time in # of hundredths (1/100) of a second delay between frames
+    fputc( static_cast<uchar>(rect->Transparent), fp );
+    fputc( 0, fp );                   // extention Block Terminator
+    filesize += 8;
+  }
+  
+  //====================================
+  // Image Descriptor
+  //====================================
+  fputc( 0x2c  , fp );                // Byte 1  : Write an Image Separator ","
+  fputw( rect->Left  , fp );          // Byte 2&3: Write the Image left offset
+  fputw( rect->Top   , fp );          // Byte 4&5: Write the Image top offset
+  fputw( rect->Width , fp );          // Byte 6&7: Write the Image width
+  fputw( rect->Height, fp );          // Byte 8&9: Write the Image height
+  fputc( interlace ? 0x40 : 0x00,fp); // Byte 10 : contains the interlaced flag 
+  return filesize + 10;
+}
+
+//------------------------------------------
+
+int imwriteGif(const char* filename, const uchar* data, int nRow, int nCol, int nBand, int nColor, 
+               const int *ColorMap,  bool interlace, int transparent, int DalayTime, char* comment,
+               bool optimize, int imMax)
+{
+  int i, filesize=0, Bands, band, band0, b, nb, n, key;
+  int BitsPerPixel=0, Width, Height, nThread, nBatch;
+  long k, nPixel;
+  char fname[256];
+  const uchar *p=data;
+  
+  strcpy(fname,filename);
+  i = static_cast<int>(strlen(fname));
+  if (fname[i-4]=='.') strcpy(strrchr(fname,'.'),".gif");
+  Width  = nCol;
+  Height = nRow;
+  Bands  = nBand;
+  nPixel = (long) Width*Height;
+  if (imMax<0) {                          // caller did not provide the maximum
+    imMax = data[0];
+    for(k=0; k<nPixel*nBand; k++, p++) if(imMax<*p) imMax=*p;
+  }
+  nColor=(nColor>256 ? 256 : nColor);     // is a power of two between 2 and 256 compute its exponent BitsPerPixel (between 1 and 8)
+  if (!nColor) nColor = imMax+1;
+  if (imMax>nColor)
+    Error("ImWriteGif: Higher pixel values than size of color table");
+  optimize = (optimize && Bands>1);
+  key = transparent;                      // color of unchanged pixels of optimized frames
+  if (optimize && key<0 && imMax<255) key = imMax+1; // use first unused color
+  n = (key>=nColor ? key+1 : nColor);
+  for(i=1; i<n; i*=2) BitsPerPixel++;  
+  if (BitsPerPixel==0) BitsPerPixel=1;
   
+  FILE *fp = fopen(fname,"wb");
+  if (fp==0) return -1;
+  filesize += WriteGifHeader(fp, Width, Height, BitsPerPixel, nColor, ColorMap, 
+                             (transparent>=0 || comment || Bands>1), comment, Bands>1);
   
-  filesize += 6 + 7 + 3*ColorMapSize;
+  GifRect *rect = new GifRect[Bands];     // by default store whole frames
   for (band=0; band<Bands; band++) {
-    if ( transparent >= 0 || Bands>1 ) {
-      fputc( 0x21, fp );                // GIF Extention Block introducer "!"
-      fputc( 0xf9, fp );                // "Graphic Control Extension" 
-      fputc( 4, fp );                   // block is of size 4
-      B  = (Bands>1 ? 2 : 0) << 2;      // Disposal Method
-      B |= (0) << 1;                    // User Input flag: is user input needed?
-      B |= (transparent >= 0 ? 1 : 0);  // Transparency flag
-      fputc( B, fp );                   // "transparency color follows" flag
-      fputw( DalayTime, fp );           // delay time in # of hundredths (1/100) of a second delay between frames
-      fputc( static_cast<uchar>(transparent), fp );
-      fputc( 0, fp );                   // extention Block Terminator
-      filesize += 8;
+    rect[band].Left = rect[band].Top = 0;
+    rect[band].Width       = Width;
+    rect[band].Height      = Height;
+    rect[band].Disposal    = (Bands>1 ? 2 : 0);
+    rect[band].Transparent = transparent;
+    rect[band].Diff        = false;
+  }
+  if (optimize) DiffFrames(data, Width, Height, Bands, transparent, key, rect);
+  
+  // Frames can be compressed independently: with several threads available,
+  // each batch of frames is LZW-compressed in parallel into memory buffers,
+  // which are then written to the file in order together with frame headers
+  nThread = (Bands>1 ? GifThreads() : 1);
+  nBatch  = (nThread>1 ? 4*nThread : 1);
+  GifOutput out(fp), *frame = (nThread>1 ? new GifOutput[nBatch] : NULL);
+  for (band0=0; band0<Bands; band0+=nBatch) {
+    nb = (Bands-band0<nBatch ? Bands-band0 : nBatch);
+    if (frame) {
+      #pragma omp parallel for schedule(dynamic) num_threads(nThread)
+      for (b=0; b<nb; b++) {
+        frame[b].Clear();
+        EncodeFrame(frame+b, data, band0+b, Width, Height, rect+band0+b, interlace, BitsPerPixel);
+      }
+    }
+    for (b=0; b<nb; b++) {
+      band = band0+b;
+      filesize += WriteFrameHeader(fp, rect+band, (transparent>=0 || Bands>1), interlace, DalayTime);
+      
+      //====================================
+      // Raster Data (LZW encrypted)
+      //====================================
+      if (frame) {                        // already compressed
+        fwrite(frame[b].Data(), frame[b].Size(), 1, fp);
+        filesize += frame[b].Size();
+      } else filesize += EncodeFrame(&out, data, band, Width, Height, rect+band, interlace, BitsPerPixel);
     }
-    
-    //====================================
-    // Image Descriptor
-    //====================================
-    fputc( 0x2c  , fp );                // Byte 1  : Write an Image Separator ","
-    fputw( 0     , fp );                // Byte 2&3: Write the Image left offset
-    fputw( 0     , fp );                // Byte 4&5: Write the Image top offset
-    fputw( Width , fp );                // Byte 6&7: Write the Image width
-    fputw( Height, fp );                // Byte 8&9: Write the Image height
-    fputc( interlace ? 0x40 : 0x00,fp); // Byte 10 : contains the interlaced flag 
-    filesize += 10;
-    
-    //====================================
-    // Raster Data (LZW encrypted)
-    //====================================
-    p = data+band*nPixel;
-    if(interlace) { // rearrange rows to do interlace 
-      int i, row=0;
-      uchar* tmp = new uchar[Width*Height];
-      for (i=0; i<Height; i+=8) memcpy(tmp+Width*(row++), p+Width*i, Width);
-      for (i=4; i<Height; i+=8) memcpy(tmp+Width*(row++), p+Width*i, Width);
-      for (i=2; i<Height; i+=4) memcpy(tmp+Width*(row++), p+Width*i, Width);
-      for (i=1; i<Height; i+=2) memcpy(tmp+Width*(row++), p+Width*i, Width);
-      filesize += EncodeLZW(fp, tmp, nPixel, BitsPerPixel);
-      delete []tmp;
-    } else filesize += EncodeLZW(fp, p, nPixel, BitsPerPixel);
   }
+  if (frame) delete []frame;
+  delete []rect;
   
   fputc(0x3b, fp );                     // Write the GIF file terminator ";"
   fclose(fp);
   return filesize+1;
 }
 
+//==============================================================
+// Streaming Gif Writer: frames are encoded and written as soon as
+// they are added, so only a single frame has to be kept in memory
+//==============================================================
+
+struct GifWriter {
+  FILE *fp;
+  int  Width, Height, BitsPerPixel, nColor, nFrame, filesize;
+  bool interlace;
+  int  transparent, DelayTime;
+};
+
+GifWriter* GifWriterOpen(const char* filename, int nRow, int nCol, int nColor, 
+                         const int *ColorMap, bool interlace, int transparent, 
+                         int DelayTime, char* comment)
+{
+  int i, n, BitsPerPixel=0;
+  char fname[256];
+  
+  strcpy(fname,filename);
+  i = static_cast<int>(strlen(fname));
+  if (fname[i-4]=='.') strcpy(strrchr(fname,'.'),".gif");
+  nColor = (nColor>256 ? 256 : nColor);
+  n = (transparent>=nColor ? transparent+1 : nColor);
+  for(i=1; i<n; i*=2) BitsPerPixel++;  
+  if (BitsPerPixel==0) BitsPerPixel=1;
+  FILE *fp = fopen(fname,"wb");
+  if (fp==0) return NULL;
+  
+  GifWriter *gif = new GifWriter;
+  gif->fp           = fp;
+  gif->Width        = nCol;
+  gif->Height       = nRow;
+  gif->BitsPerPixel = BitsPerPixel;
+  gif->nColor       = nColor;
+  gif->nFrame       = 0;
+  gif->interlace    = interlace;
+  gif->transparent  = transparent;
+  gif->DelayTime    = DelayTime;
+  // number of frames is not known in advance so always write an animation
+  gif->filesize = WriteGifHeader(fp, nCol, nRow, BitsPerPixel, nColor, ColorMap, 
+                                 true, comment, true);
+  return gif;
+}
+
+//------------------------------------------
+
+int GifWriterAdd(GifWriter *gif, const uchar* data)
+{
+  long i, nPixel = (long) gif->Width*gif->Height;
+  GifRect rect;
+  for(i=0; i<nPixel; i++)                // pixel outside of the color palette
+    if (data[i]>=gif->nColor && data[i]!=gif->transparent) return -1;
+  rect.Left = rect.Top = 0;
+  rect.Width       = gif->Width;
+  rect.Height      = gif->Height;
+  rect.Disposal    = 2;
+  rect.Transparent = gif->transparent;
+  GifOutput out(gif->fp);
+  gif->filesize += WriteFrameHeader(gif->fp, &rect, true, gif->interlace, gif->DelayTime);
+  gif->filesize += EncodeImage(&out, data, gif->Width, gif->Height, gif->interlace, gif->BitsPerPixel);
+  gif->nFrame++;
+  return gif->nFrame;
+}
+
+//------------------------------------------
+
+long GifWriterPixels(const GifWriter *gif)
+{ // number of pixels of each frame
+  return (long) gif->Width*gif->Height;
+}
+
+//------------------------------------------
+
+int GifWriterClose(GifWriter *gif)
+{
+  int filesize = gif->filesize+1;
+  fputc(0x3b, gif->fp );                // Write the GIF file terminator ";"
+  fclose(gif->fp);
+  delete gif;
+  return filesize;
+}
+
 //==============================================================
 // Gif Reader
 // Limitations:
@@ -539,32 +978,48 @@ int ReadColorMap(FILE *fp, uchar byte, int ColorMap[256], int skip=0)
 
 //------------------------------------------
 
-uchar* append(uchar *trg, uchar *src, int nPixel, int nBand )
+void GifFreeIndex(GifIndex *index)
 {
-  uchar* data = R_Calloc(nPixel*(nBand+1), uchar);
-  int n = nPixel*nBand*sizeof(uchar);
-  memcpy(data  , trg, n);
-  memcpy(data+n, src, nPixel*sizeof(uchar));
-  R_Free(trg); 
-  R_Free(src); 
-  return data;
+  if (index->Frame)    R_Free(index->Frame);
+  if (index->Comment)  R_Free(index->Comment);
+  if (index->FileName) R_Free(index->FileName);
+  if (index->fp) fclose(index->fp);
+  index->fp = NULL;
+  index->nFrame = index->nAlloc = 0;
 }
 
 //------------------------------------------
 
-int imreadGif(const char* filename, int nImage, bool verbose,
-              uchar** data, int &nRow, int &nCol, int &nBand,
-              int ColorMap[255], int &Transparent, char** Comment)
+GifFrame* AddFrame(GifIndex *index)
+{ // make room for one more frame record, doubling the array when full
+  if (index->nFrame==index->nAlloc) {
+    int n = (index->nAlloc ? 2*index->nAlloc : 16);
+    GifFrame *frame = R_Calloc(n, GifFrame);
+    if (index->nFrame) {
+      memcpy(frame, index->Frame, index->nFrame*sizeof(GifFrame));
+      R_Free(index->Frame);
+    }
+    index->Frame  = frame;
+    index->nAlloc = n;
+  }
+  return index->Frame + index->nFrame++;
+}
+
+//------------------------------------------
+// First phase of reading: walks through all blocks of the file and records 
+// descriptor, color map and raster data offset of each frame. Raster data
+// blocks are skipped using their byte counts, without decoding.
+// returns:   number of bytes in the file or negative error number
+//------------------------------------------
+
+int GifScan(const char* filename, bool verbose, GifIndex *index)
 {
-  bool interlace;
-  uchar buffer[256], *cube=0, *image=0;
-  int Width, Height, i, c, iImage, ret, DelayTime, stats, done, n, m, nColMap=0, filesize=0;
+  uchar buffer[256];
+  int i, c, n, m, stats, done, Transparent=-1, DelayTime=0, Disposal=0, filesize=0;
   char version[7], fname[256], *p, *comment=0;
+  GifFrame *frame;
   
-  *data=NULL;
-  *Comment=NULL;
-  Width=Height=nRow=nCol=nBand=0; 
-  ret=Transparent=-1;
+  memset(index, 0, sizeof(GifIndex));
   strcpy(fname,filename);
   i = static_cast<int>( strlen(fname));
   if (fname[i-4]=='.') strcpy(strrchr(fname,'.'),".gif");
@@ -579,19 +1034,23 @@ int imreadGif(const char* filename, int nImage, bool verbose,
   if ((strcmp(version, "GIF87a") != 0) && (strcmp(version, "GIF89a") != 0)) { fclose(fp); return -2; }
   if (!fread(buffer, 7, 1, fp)) { fclose(fp); return -3; }     // Read Screen Descriptor
   if(verbose) print("GIF image header\n");
-  i = ReadColorMap(fp, buffer[4], ColorMap);   // Read Global Colormap
+  index->nCol = getint(buffer);
+  index->nRow = getint(buffer+2);
+  i = ReadColorMap(fp, buffer[4], index->ColorMap);   // Read Global Colormap
   if (i==0) { fclose(fp); return -3; }
-  if (i==2) nColMap++;
+  if (i==2) index->nColor = 2<<(buffer[4]&0x07);
   if(verbose) {
-    if(i==2) print("Global colormap with %i colors \n", 2<<(buffer[4]&0x07));
+    if(i==2) print("Global colormap with %i colors \n", index->nColor);
     else     print("No global colormap provided\n");
   }
   filesize += 6 + 7 + 3*256;
+  index->FileName = R_Calloc(strlen(fname)+1, char);
+  strcpy(index->FileName, fname);
   
   //====================================================
   // Raster Data of encoded images and Extention Blocks
   //====================================================
-  iImage = stats = done = 0;
+  stats = done = 0;
   while(!stats && !done) {
     c = fgetc(fp);
     switch(c) {
@@ -610,20 +1069,21 @@ int imreadGif(const char* filename, int nImage, bool verbose,
         n = GetDataBlock(fp, buffer);               // block is of size 4
         if (n==4) {                                 // block has to be of size 4
           DelayTime = getint(buffer+1);
+          Disposal  = (buffer[0]>>2) & 0x7;
           if ((buffer[0] & 0x1) != 0) Transparent = buffer[3];
           if(verbose) 
             print("Graphic Control Extension (delay=%i transparent=%i)\n",
                   DelayTime, Transparent);
         }
-        while (GetDataBlock(fp, buffer) != 0);      // look for block terminator
+        if (n>0) while (GetDataBlock(fp, buffer) > 0); // look for block terminator
         break;
       case 0xfe:                                    // "Comment Extension" 
         m = (comment ? static_cast<int>(strlen(comment)) : 0);
-        while ((n=GetDataBlock(fp, buffer)) != 0) { // look for block terminator
+        while ((n=GetDataBlock(fp, buffer)) > 0) {  // look for block terminator
           p = R_Calloc(m+n+1,char);
           if(m>0) {                                // if there was a previous comment than whey will be concatinated
             memcpy(p,comment,m);
-            free(comment);
+            R_Free(comment);
           }
           comment = p;
           strncpy(comment+m, (char*) buffer, n);
@@ -633,15 +1093,15 @@ int imreadGif(const char* filename, int nImage, bool verbose,
         if(verbose) print("Comment Extension\n");
         break;
       case 0xff:                                    // "Software Specific Extension" most likelly NETSCAPE2.0 
-        while (GetDataBlock(fp, buffer) != 0);      // look for block terminator
+        while (GetDataBlock(fp, buffer) > 0);       // look for block terminator
         if(verbose) print("Animation Extension\n");
         break;
       case 0x01:                                    // "Plain Text Extension" 
-        while (GetDataBlock(fp, buffer) != 0);      // look for block terminator
+        while (GetDataBlock(fp, buffer) > 0);       // look for block terminator
         if(verbose) print("Plain Text Extension (ignored)\n");
         break;
       default:                                      // Any other type of Extension
-        while (GetDataBlock(fp, buffer) != 0);      // look for block terminator
+        while (GetDataBlock(fp, buffer) > 0);       // look for block terminator
       if(verbose) print("Unknown Extension %i\n", c);
       break;
       }
@@ -652,50 +1112,32 @@ int imreadGif(const char* filename, int nImage, bool verbose,
       // Image Descriptor
       //====================================
       if (!fread(buffer, 9, 1, fp)) {stats=3; break;} // unexpected EOF
-      Width     = getint(buffer+4); // Byte 6&7: Read the Image width
-      Height    = getint(buffer+6); // Byte 8&9: Read the Image height
-      interlace = ((buffer[8]&0x40)==0x40);
-      if(verbose) print("Image [%i x %i]: ", Height, Width);
-      if (!nImage && nBand>0 && (nRow!=Height || nCol!=Width)) {stats=5; break;}
+      frame = AddFrame(index);
+      frame->Left        = getint(buffer  ); // Byte 2&3: Read the Image left offset
+      frame->Top         = getint(buffer+2); // Byte 4&5: Read the Image top offset
+      frame->Width       = getint(buffer+4); // Byte 6&7: Read the Image width
+      frame->Height      = getint(buffer+6); // Byte 8&9: Read the Image height
+      frame->Interlace   = ((buffer[8]&0x40)==0x40);
+      frame->Transparent = Transparent;
+      frame->DelayTime   = DelayTime;
+      frame->Disposal    = Disposal;
+      if(verbose) print("Image [%i x %i]: ", frame->Height, frame->Width);
       
       //=============================================
       // Local Color Map & Raster Data (LZW encrypted)
       //=============================================
-      i = ReadColorMap(fp, buffer[8], ColorMap, nColMap*nImage); // Read local Colormap
+      i = ReadColorMap(fp, buffer[8], frame->ColorMap); // Read local Colormap
       if (i==0) {stats=3; break;} // EOF found during reading local colormap
-      if (i==2) nColMap++;
-      if(image) R_Free(image);
-      image = R_Calloc(Height*Width, uchar);
-      ret   = DecodeLZW(fp, image, Height*Width);
-      //        if (ret==0) {stats=4; break;} // syntax error
-      if(interlace) {
-        int i, row=0;
-        uchar* to   = image;
-        uchar* from = new uchar[Width*Height];
-        memcpy(from, to, Width*Height);
-        for (i=0; i<Height; i+=8) memcpy(to+Width*i, from+Width*(row++), Width);
-        for (i=4; i<Height; i+=8) memcpy(to+Width*i, from+Width*(row++), Width);
-        for (i=2; i<Height; i+=4) memcpy(to+Width*i, from+Width*(row++), Width);
-        for (i=1; i<Height; i+=2) memcpy(to+Width*i, from+Width*(row++), Width);
-        delete []from;
-      }
-      if (!nImage) {              // save all bands
-        if (!nBand) cube = image; // first image
-        else cube = append(cube, image, Height*Width, nBand);
-        nBand++;
-      } else {                    // replace each image with new one
-        if(cube) R_Free(cube);
-        cube  = image;
-        nBand = 1;
-      }
-      image = 0;
-      nRow = Height;
-      nCol = Width;
-      if (ret==0) {stats=4; break;} // DecodeLZW exit without finding file terminator
-      else filesize += ret+10;
-      if (++iImage==nImage) done=1;
-      if(verbose) print("%i bytes \n", ret);
-      if(verbose && i==2) print("Local colormap with %i colors \n", 2<<(buffer[4]&0x07));
+      if (i==2) frame->nColor = 2<<(buffer[8]&0x07);
+      frame->Offset = ftell(fp);
+      if (fgetc(fp)==EOF) {stats=3; break;}        // "code size" byte
+      for (m=1; (n=fgetc(fp))>0; m+=n+1)           // skip data blocks up to ...
+        if (fseek(fp, n, SEEK_CUR)) break;         // ... the block terminator
+      if (n==EOF) {stats=3; break;}                // unexpected EOF
+      frame->nByte = m+1;
+      filesize += frame->nByte+10;
+      if(verbose) print("%i bytes \n", frame->nByte);
+      if(verbose && i==2) print("Local colormap with %i colors \n", frame->nColor);
       break;
       
     default:
@@ -706,15 +1148,202 @@ int imreadGif(const char* filename, int nImage, bool verbose,
   } // end while
   if(verbose) print("\n");
   fclose(fp);
-  *Comment = comment;
-  *data = cube;
-  nRow  = Height;
-  nCol  = Width;
+  index->Comment = comment;
+  index->stats   = stats;
+  index->nByte   = filesize;
+  return filesize;
+}
+
+//------------------------------------------
+// Decodes raster data of a single indexed frame into data[Width*Height], 
+// stored in given 'order'
+//------------------------------------------
+
+typedef struct { uchar r, g, b;    } GifRGB;   // pixel formats used for
+typedef struct { uchar r, g, b, a; } GifRGBA;  // output of colors
+
+// pixel value for color index i: index itself if there is no ColorMap,
+// otherwise its color, with transparent color having alpha of 0
+inline void SetPixel(uchar &p, int i, const int*, int) { p = static_cast<uchar>(i); }
+inline void SetPixel(int &p, int i, const int *ColorMap, int transparent) 
+{ // colors are packed as in R's native rasters: R | G<<8 | B<<16 | A<<24
+  if (!ColorMap) { p = i; return; }
+  unsigned int c = ColorMap[i];
+  c = ((c>>16) & 0xff) | (c & 0xff00) | ((c & 0xff)<<16) | (i==transparent ? 0 : 0xff000000u);
+  p = static_cast<int>(c);
+}
+inline void SetPixel(GifRGB &p, int i, const int *ColorMap, int) 
+{ 
+  p.r = static_cast<uchar>(ColorMap[i]>>16);
+  p.g = static_cast<uchar>(ColorMap[i]>>8);
+  p.b = static_cast<uchar>(ColorMap[i]);
+}
+inline void SetPixel(GifRGBA &p, int i, const int *ColorMap, int transparent) 
+{ 
+  p.r = static_cast<uchar>(ColorMap[i]>>16);
+  p.g = static_cast<uchar>(ColorMap[i]>>8);
+  p.b = static_cast<uchar>(ColorMap[i]);
+  p.a = (i==transparent ? 0 : 255);
+}
+
+template <class T> int GifDecodeFrame(FILE *fp, const GifFrame *frame, T* data, int order, 
+                                      const int *ColorMap)
+{ // ColorMap==NULL: store color indices, otherwise colors
+  int i, Width=frame->Width, Height=frame->Height;
+  T lut[256];
+  if (fp==0 || fseek(fp, frame->Offset, SEEK_SET)) return 0;
+  for (i=0; i<256; i++) SetPixel(lut[i], i, ColorMap, frame->Transparent);
+  PixelSink<T> out(data, Width, Height, order, lut, frame->Interlace);
+  return DecodeLZW(fp, out, (long) Width*Height);
+}
+
+//------------------------------------------
+// Second phase of reading: decodes nFrame consecutive frames, starting with
+// frame iFirst, into disjoint slices of 'data'. All frames are assumed to 
+// have the same size. Frames are independent once their raster data offsets 
+// are known, so they are decoded in parallel, each thread using its own 
+// file handle. Single frames are read through a handle kept by the index, 
+// so that an index can serve repeated requests for random frames. 
+// If 'color' is set, each frame is stored using its own color map.
+// returns:   number of leading frames decoded without errors
+//------------------------------------------
+
+template <class T> int DecodeFrames(GifIndex *index, int iFirst, int nFrame, T *data, 
+                                    int order, bool color)
+{
+  int iFrame, nGood, *ret;
+  const GifFrame *frame = index->Frame+iFirst;
+  long nPixel = (long) frame->Width*frame->Height;
+  #define FRAME_MAP(f) (!color ? NULL : ((f)->nColor ? (f)->ColorMap : index->ColorMap))
+  
+  if (nFrame==1) { // random access to a single frame: reuse the file handle
+    if (!index->fp) index->fp = fopen(index->FileName, "rb");
+    return (GifDecodeFrame(index->fp, frame, data, order, FRAME_MAP(frame)) ? 1 : 0);
+  }
+  ret = new int[nFrame];
+
+  #pragma omp parallel private(iFrame)
+  {
+    FILE *fp = fopen(index->FileName, "rb");
+    #pragma omp for schedule(dynamic)
+    for (iFrame=0; iFrame<nFrame; iFrame++) 
+      ret[iFrame] = GifDecodeFrame(fp, frame+iFrame, data+iFrame*nPixel, order, 
+                                   FRAME_MAP(frame+iFrame));
+    if (fp) fclose(fp);
+  }
+  #undef FRAME_MAP
+  for (nGood=0; nGood<nFrame && ret[nGood]; nGood++);
+  delete []ret;
+  return nGood;
+}
+
+int GifDecodeFrames(GifIndex *index, int iFirst, int nFrame, uchar *data, int order, 
+                    int nChannel)
+{ 
+  switch (nChannel) {
+    case 3:  return DecodeFrames(index, iFirst, nFrame, (GifRGB *) data, order, true);
+    case 4:  return DecodeFrames(index, iFirst, nFrame, (GifRGBA*) data, order, true);
+    default: return DecodeFrames(index, iFirst, nFrame, data, order, false);
+  }
+}
+
+int GifDecodeFramesInt(GifIndex *index, int iFirst, int nFrame, int *data, int order, 
+                       bool native)
+{ return DecodeFrames(index, iFirst, nFrame, data, order, native); }
+
+//------------------------------------------
+// Selects frames to be read: either all frames of the same size as the first 
+// one or only the requested one. Color map of the last selected frame with a
+// local map is returned (global one if none).
+// returns:   error status of the index; 5 if frames of different sizes were 
+//            skipped; +6 if there were several color maps
+//------------------------------------------
+
+int GifSelectFrames(GifIndex *index, int nImage, int &iFirst, int &nFrame,
+                    int ColorMap[256], int &Transparent)
+{
+  GifFrame *frame;
+  int i, stats=index->stats, nColMap=(index->nColor ? 1 : 0);
+  
+  Transparent=-1;
+  memcpy(ColorMap, index->ColorMap, 256*sizeof(int));
+  nFrame = index->nFrame;
+  iFirst = 0;
+  if (nImage && nFrame) {                 // replace each image with new one
+    iFirst = (nImage<nFrame ? nImage : nFrame)-1;
+    nFrame = 1;
+  }
+  frame = index->Frame+iFirst;
+  for (i=0; i<nFrame; i++, frame++) {
+    if (frame->Width!=index->Frame[iFirst].Width || frame->Height!=index->Frame[iFirst].Height) 
+    {nFrame=i; stats=5; break;}           // all bands have to be the same size
+    if (frame->nColor) {                  // use local color map
+      memcpy(ColorMap, frame->ColorMap, 256*sizeof(int));
+      nColMap++;
+    }
+    Transparent = frame->Transparent;
+  }
   if (nImage==0 && nColMap>1) stats += 6;
+  return stats;
+}
+
+//------------------------------------------
+
+int imreadGifIndex(GifIndex *index, int nImage, uchar** data, int &nRow, 
+                   int &nCol, int &nBand, int ColorMap[255], int &Transparent, 
+                   char** Comment, int nChannel)
+{
+  int iFirst, nFrame, nGood, stats, filesize;
+  
+  *data=NULL;
+  *Comment=NULL;
+  nRow=nCol=nBand=0; 
+  filesize = index->nByte;
+  stats    = GifSelectFrames(index, nImage, iFirst, nFrame, ColorMap, Transparent);
+  
+  //====================================================
+  // Decode the selected frames in parallel
+  //====================================================
+  if (nFrame) {
+    nRow  = index->Frame[iFirst].Height;
+    nCol  = index->Frame[iFirst].Width;
+    *data = R_Calloc((long) nRow*nCol*nFrame*nChannel, uchar);
+    nGood = GifDecodeFrames(index, iFirst, nFrame, *data, GIF_ROWS, nChannel);
+    if (nGood<nFrame) {                   // DecodeLZW exit without finding file terminator
+      nFrame = nGood+1;                   // keep the corrupted frame, drop the rest
+      if (stats%6==0) stats+=4;           // unless other error was already found
+    }
+    nBand = nFrame;
+  }
+  if (index->Comment) {
+    *Comment = R_Calloc(strlen(index->Comment)+1, char);
+    strcpy(*Comment, index->Comment);
+  }
   if (stats) filesize = -stats; // if no image than save error #
   return filesize;
 }
 
+//------------------------------------------
+
+int imreadGif(const char* filename, int nImage, bool verbose,
+              uchar** data, int &nRow, int &nCol, int &nBand,
+              int ColorMap[255], int &Transparent, char** Comment, int nChannel)
+{
+  GifIndex index;
+  int filesize = GifScan(filename, verbose, &index);
+  if (filesize<0) {                       // file not found or not a GIF file
+    memcpy(ColorMap, index.ColorMap, 256*sizeof(int));
+    *data=NULL;
+    *Comment=NULL;
+    nRow=nCol=nBand=0; 
+    Transparent=-1;
+    return filesize; 
+  }
+  filesize = imreadGifIndex(&index, nImage, data, nRow, nCol, nBand, 
+                            ColorMap, Transparent, Comment, nChannel);
+  GifFreeIndex(&index);
+  return filesize;
+}
 
 //==============================================================
 // Section below is used in interface with Matrix Library
@@ -725,7 +1354,7 @@ template <> int imwriteGif<uchar>(const bMatrix &im, const char* filename, const
                                   bool interlace, int transparent, int delayTime, char* comment)
 {
   int ret = imwriteGif(filename, im->d(), im->rows(), im->cols(), im->bands(), 
-                       ColorMap->len(), ColorMap->d(), interlace, transparent, delayTime, comment);
+                       ColorMap->len(), ColorMap->d(), interlace, transparent, delayTime, comment, false);
   if (ret<0) Error("write.gif: cannot open the output GIF file");
   return ret;
 }
@@ -775,31 +1404,261 @@ int imreadGif(bMatrix &im, const char* filename, iMatrix &ColorMap, int imageNum
 
 
 //==============================================================
-// Section below is used in standalone test application
+// Section below is used in standalone test application:
+//   g++ -O2 -fopenmp -DSTANDALONE_TEST -I$R_HOME/include GifTools.cpp -L$R_HOME/lib -lR
+//   ./a.out          - round-trip tests followed by throughput benchmark
+//   ./a.out file.gif - read and re-write a file; also AFL harness: afl-fuzz ... ./a.out @@
+// or fuzzing entry point for libFuzzer:
+//   clang++ -g -fsanitize=fuzzer,address -DGIF_FUZZ -I$R_HOME/include GifTools.cpp -L$R_HOME/lib -lR
 //==============================================================
-#ifdef STANDALONE_TEST
+#if defined(STANDALONE_TEST) || defined(GIF_FUZZ)
 
-int main()
-{
-  bool interlace;
-  int nRow, nCol, nBand, ColorMap[256], transparent, *Data=0, DelayTime, nImage, succes, n;
-  char *Comment=0, str[256];
+int ReadGifFile(const char *filename, bool verbose)
+{ // read a file and release everything, as R would do
+  int nRow, nCol, nBand, ColorMap[256], transparent, ret;
+  char *Comment=0;
   uchar *data=0;
-  
-  interlace = 0;
-  DelayTime = 0;
-  nImage    = 0;
-  succes = imreadGif ("bats.gif", nImage, (bool) 1, &data, nRow, nCol, nBand, ColorMap, transparent, &Comment);
-  printf("Image read = [%i x %i x %i]: %i\n",nRow, nCol, nBand, succes);
-  if (1) {
-    n = nRow*nCol;
-    strcpy(str, "hello world");
-    succes = imwriteGif("tmp.gif", data, nRow, nCol, nBand, 256, ColorMap, interlace, transparent, DelayTime, str);
-    printf("Image written = [%i x %i x %i]: %i\n",nRow, nCol, nBand, succes);
-  }
-  printf("Press any key\n");
-  getchar();
+  ret = imreadGif(filename, 0, verbose, &data, nRow, nCol, nBand, ColorMap, transparent, &Comment);
+  if (verbose) printf("Image read = [%i x %i x %i]: %i\n",nRow, nCol, nBand, ret);
+  if (data)    R_Free(data);
+  if (Comment) R_Free(Comment);
+  return ret;
+}
+#endif
+
+#ifdef GIF_FUZZ
+#include <unistd.h>  // getpid
+
+extern "C" int LLVMFuzzerTestOneInput(const uchar *buffer, size_t size)
+{ // decoder reads from files, so each input is passed through a file
+  char fname[64];
+  sprintf(fname, "gif_fuzz_%i.gif", (int) getpid());
+  FILE *fp = fopen(fname, "wb");
+  if (!fp) return 0;
+  fwrite(buffer, size, 1, fp);
+  fclose(fp);
+  // skip inputs declaring huge frames, which would only test the allocator
+  GifIndex index;
+  if (GifScan(fname, false, &index)>=0) {
+    long nPixel=0;
+    for (int i=0; i<index.nFrame; i++) 
+      nPixel += (long) index.Frame[i].Width*index.Frame[i].Height;
+    GifFreeIndex(&index);
+    if (nPixel<(1<<24)) ReadGifFile(fname, false);
+  } else GifFreeIndex(&index);
+  remove(fname);
   return 0;
 }
+#endif //GIF_FUZZ
 
+#if defined(STANDALONE_TEST) && !defined(GIF_FUZZ)
+#include <chrono>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>  // getpid
 #endif
+
+inline double WallTime()
+{ // elapsed time in seconds; clock() would sum the time of all threads
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+const char* TempGifName()
+{ // files written and read by the tests are kept in the temporary directory
+  static char fname[1024] = "";
+  if (!*fname) {
+    const char *dir = getenv("TMPDIR");
+    if (!dir) dir = getenv("TEMP");
+    if (!dir) dir = "/tmp";
+    snprintf(fname, sizeof(fname), "%s/gif_test_%i.gif", dir, (int) getpid());
+  }
+  return fname;
+}
+
+inline int Random(int n) { return (int) ((double) rand()/((double) RAND_MAX+1)*n); }
+
+void RandomImage(uchar *data, long nPixel, int nBits)
+{ // noise mixed with runs and repeated fragments, to exercise the string-table
+  long i;
+  int nColor = 1<<nBits;
+  for (i=0; i<nPixel; i++) {
+    int r = Random(4);
+    if      (i>0    && r==0) data[i] = data[i-1];
+    else if (i>=100 && r==1) data[i] = data[i-100+Random(50)];
+    else data[i] = static_cast<uchar>(Random(nColor));
+  }
+}
+
+uchar* CompositeGif(const char* filename, int &nRow, int &nCol, int &nBand)
+{ // renders every frame of an animation, drawing sub-images on top of the 
+  // previous frame and honoring transparency and disposal methods; cleared 
+  // pixels get the transparent color of the first frame (or 0)
+  GifIndex index;
+  int iFrame, row, col;
+  uchar *data=0, *canvas, *sub;
+  nRow=nCol=nBand=0;
+  if (GifScan(filename, false, &index)<0) return 0;
+  if (index.nFrame) {
+    const GifFrame *frame = index.Frame;
+    uchar clear = static_cast<uchar>(frame->Transparent>=0 ? frame->Transparent : 0);
+    long nPixel = (long) index.nRow*index.nCol;
+    nRow  = index.nRow;
+    nCol  = index.nCol;
+    nBand = index.nFrame;
+    data  = new uchar[nPixel*nBand];
+    canvas = new uchar[nPixel];
+    memset(canvas, clear, nPixel);
+    for (iFrame=0; iFrame<nBand; iFrame++, frame++) {
+      sub = new uchar[(size_t) frame->Width*frame->Height];
+      if (GifDecodeFrames(&index, iFrame, 1, sub, GIF_ROWS, 1)!=1) 
+        memset(sub, clear, (size_t) frame->Width*frame->Height);
+      for (row=0; row<frame->Height && frame->Top+row<nRow; row++) 
+        for (col=0; col<frame->Width && frame->Left+col<nCol; col++) {
+          uchar v = sub[(long) row*frame->Width+col];
+          if (v!=frame->Transparent) canvas[(long) (frame->Top+row)*nCol+frame->Left+col] = v;
+        }
+      memcpy(data+iFrame*nPixel, canvas, nPixel);
+      if (frame->Disposal==2) memset(canvas, clear, nPixel);
+      delete []sub;
+    }
+    delete []canvas;
+  }
+  GifFreeIndex(&index);
+  return data;
+}
+
+int RoundTripTest()
+{ // EncodeLZW->DecodeLZW and imwriteGif->imreadGif round trips of random 
+  // images of every bit depth, interlaced or not, with and without transparency
+  int nBits, interlace, trans, iTest, nFail=0, nTest=0;
+  uchar lut[256];
+  for (nBits=0; nBits<256; nBits++) lut[nBits] = static_cast<uchar>(nBits);
+  for (nBits=1; nBits<=8; nBits++) 
+    for (interlace=0; interlace<2; interlace++) 
+      for (trans=0; trans<2; trans++) 
+        for (iTest=0; iTest<4; iTest++) {
+    int Width  = (iTest ? 1+Random(200) : 512); // first test is large to force 
+    int Height = (iTest ? 1+Random(200) : 512); // flushing of the string-table
+    int nBand  = 1+Random(3), ColorMap[256], i, ret;
+    long nPixel = (long) Width*Height;
+    int transparent = (trans ? Random(1<<nBits) : -1);
+    uchar *data = new uchar[nPixel*nBand], *back = new uchar[nPixel];
+    RandomImage(data, (long) nPixel*nBand, nBits);
+    for (i=0; i<256; i++) ColorMap[i] = i*0x010101;
+    
+    // LZW codec alone
+    FILE *fp = tmpfile();
+    PixelSource src(data, Width, Height, interlace!=0);
+    GifOutput out(fp);
+    EncodeLZW(&out, src, nPixel, nBits);
+    rewind(fp);
+    PixelSink<uchar> sink(back, Width, Height, GIF_ROWS, lut, interlace!=0);
+    ret = DecodeLZW(fp, sink, nPixel);
+    fclose(fp);
+    nTest++;
+    if (!ret || memcmp(data, back, nPixel)) {
+      printf("FAIL: LZW round trip: %i bits, %i x %i, interlace=%i\n", nBits, Width, Height, interlace);
+      nFail++;
+    }
+    
+    // whole files
+    int nRow, nCol, nBand2, ColorMap2[256], transparent2;
+    char *Comment=0;
+    uchar *data2=0;
+    imwriteGif(TempGifName(), data, Height, Width, nBand, 1<<nBits, ColorMap, interlace!=0, 
+               transparent, 0, 0, false);
+    ret = imreadGif(TempGifName(), 0, false, &data2, nRow, nCol, nBand2, ColorMap2, transparent2, &Comment);
+    nTest++;
+    if (ret<=0 || nRow!=Height || nCol!=Width || nBand2!=nBand || 
+        transparent2!=transparent || memcmp(data, data2, nPixel*nBand)) {
+      printf("FAIL: file round trip: %i bits, %i x %i x %i, interlace=%i, transparent=%i\n", 
+             nBits, Width, Height, nBand, interlace, transparent);
+      nFail++;
+    }
+    if (data2)   R_Free(data2);
+    if (Comment) R_Free(Comment);
+    
+    // optimized animations store frame differences: compare composited frames
+    imwriteGif(TempGifName(), data, Height, Width, nBand, 1<<nBits, ColorMap, interlace!=0, 
+               transparent, 0, 0, true);
+    uchar *data3 = CompositeGif(TempGifName(), nRow, nCol, nBand2);
+    nTest++;
+    if (!data3 || nRow!=Height || nCol!=Width || nBand2!=nBand || memcmp(data, data3, nPixel*nBand)) {
+      printf("FAIL: optimized round trip: %i bits, %i x %i x %i, interlace=%i, transparent=%i\n", 
+             nBits, Width, Height, nBand, interlace, transparent);
+      nFail++;
+    }
+    if (data3) delete []data3;
+    delete []data;
+    delete []back;
+  }
+  remove(TempGifName());
+  printf("Round trip tests: %i of %i passed\n", nTest-nFail, nTest);
+  return nFail;
+}
+
+void Benchmark()
+{ // throughput of the LZW codec and of whole file writing & reading
+  int Width=1024, Height=1024, nBand=8, nPixel=Width*Height, ColorMap[256], i, band;
+  long n = (long) nPixel*nBand;
+  double t, MB = n/1048576.0;
+  uchar *data = new uchar[n], *back = new uchar[nPixel], lut[256];
+  for (i=0; i<256; i++) lut[i] = static_cast<uchar>(i);
+  for (band=0; band<nBand; band++)  // smooth image with some noise
+    for (i=0; i<nPixel; i++) 
+      data[band*nPixel+i] = static_cast<uchar>((i%Width + i/Width + 8*band)/8 + Random(4));
+  for (i=0; i<256; i++) ColorMap[i] = i*0x010101;
+  
+  GifOutput mem;
+  t = WallTime();
+  for (band=0; band<nBand; band++) {
+    mem.Clear();
+    EncodeLZW(&mem, data+band*nPixel, nPixel, 8);
+  }
+  t = WallTime()-t;
+  printf("EncodeLZW : %7.1f MB/s (compressed to %i bytes per frame)\n", MB/t, mem.Size());
+  FILE *fp = tmpfile();
+  fwrite(mem.Data(), mem.Size(), 1, fp);
+  t = WallTime();
+  for (band=0; band<nBand; band++) {
+    rewind(fp);
+    PixelSink<uchar> sink(back, Width, Height, GIF_ROWS, lut);
+    DecodeLZW(fp, sink, nPixel);
+  }
+  t = WallTime()-t;
+  fclose(fp);
+  printf("DecodeLZW : %7.1f MB/s\n", MB/t);
+  
+  t = WallTime();
+  imwriteGif(TempGifName(), data, Height, Width, nBand, 256, ColorMap, false, -1, 0, 0, false);
+  t = WallTime()-t;
+  printf("imwriteGif: %7.1f MB/s\n", MB/t);
+  t = WallTime();
+  ReadGifFile(TempGifName(), false);
+  t = WallTime()-t;
+  printf("imreadGif : %7.1f MB/s\n", MB/t);
+  remove(TempGifName());
+  delete []data;
+  delete []back;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc>1) {  // read files, which can be malformed
+    for (int i=1; i<argc; i++) ReadGifFile(argv[i], true);
+    return 0;
+  }
+  srand(1);
+  int nFail = RoundTripTest();
+  Benchmark();
+  return (nFail ? 1 : 0);
+}
+
+#endif //STANDALONE_TEST
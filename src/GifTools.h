@@ -14,13 +14,77 @@ extern "C" {
   #define Error Rf_error
   typedef unsigned char uchar;
 
+  //------------------------------------------------------------------
+  // Frame index of a GIF file built by GifScan in a single skim of the 
+  // block headers. Raster data is skipped, not decoded, so every frame 
+  // can later be decoded independently starting from its 'Offset'.
+  //------------------------------------------------------------------
+  typedef struct {
+    long Offset;             // file position of the raster data "code size" byte
+    int  Left, Top;          // image position within the logical screen
+    int  Width, Height;      // image size
+    bool Interlace;          // are rows stored in 4-pass interlaced order?
+    int  Transparent;        // transparent color in effect for this frame or -1
+    int  DelayTime;          // delay in 1/100 sec. from Graphic Control Extension
+    int  Disposal;           // disposal method from Graphic Control Extension
+    int  nColor;             // size of local color map or 0 if global one is used
+    int  ColorMap[256];      // local color map
+    int  nByte;              // size of the raster data section in bytes
+  } GifFrame;
+  
+  typedef struct {
+    char *FileName;          // file the index was built from
+    int  nRow, nCol;         // logical screen size
+    int  nColor;             // size of global color map or 0 if none
+    int  ColorMap[256];      // global color map
+    int  nFrame, nAlloc;     // number of frames found & allocated
+    GifFrame *Frame;         // one record per frame
+    char *Comment;           // concatenated Comment Extensions
+    int  stats;              // 0 - OK, 3 - unexpected EOF, 4 - syntax error 
+    int  nByte;              // number of bytes scanned
+    FILE *fp;                // file handle used for random frame access
+  } GifIndex;
+
+  typedef struct GifWriter GifWriter;
+  GifWriter* GifWriterOpen(const char* filename, int nRow, int nCol, int nColor, 
+                           const int *ColorMap, bool interlace, int transparent, 
+                           int DelayTime, char* comment);
+  int  GifWriterAdd(GifWriter *gif, const uchar* data);
+  long GifWriterPixels(const GifWriter *gif);
+  int  GifWriterClose(GifWriter *gif);
+
+  int  GifScan(const char* filename, bool verbose, GifIndex *index);
+  void GifFreeIndex(GifIndex *index);
+  // order of decoded pixels: pixel (x,y) of Width x Height frame is stored at
+  #define GIF_ROWS    0      // [x + y*Width]        - as in the file
+  #define GIF_COLUMNS 1      // [y + x*Height]       - R's [row, col] matrix
+  #define GIF_FLIPPED 2      // [x + (Height-1-y)*Width] - orientation of R's image()
+  int  GifSelectFrames(GifIndex *index, int nImage, int &iFirst, int &nFrame,
+                       int ColorMap[256], int &Transparent);
+  // nChannel: 1 - color indices, 3 - RGB or 4 - RGBA bytes per pixel;
+  // native: store colors packed as in R's native rasters instead of indices
+  int  GifDecodeFrames(GifIndex *index, int iFirst, int nFrame, uchar *data, int order,
+                       int nChannel=1);
+  int  GifDecodeFramesInt(GifIndex *index, int iFirst, int nFrame, int *data, int order,
+                          bool native=false);
+  int  imreadGifIndex(GifIndex *index, int nImage, uchar** data, int &nRow, 
+                      int &nCol, int &nBand, int ColorMap[255], int &Transparent, 
+                      char** Comment, int nChannel=1);
+
   int imreadGif(const char* filename, int nImage, bool verbose,
               uchar** data, int &nRow, int &nCol, int &nBand,
-              int ColorMap[255], int &Transparent, char** Comment);
+              int ColorMap[255], int &Transparent, char** Comment, int nChannel=1);
               
   int imwriteGif(const char* filename, const uchar* data, int nRow, int nCol,
                   int nBand, int nColor, const int *ColorMap,  bool interlace, 
-                 int transparent, int DalayTime, char* comment);
+                 int transparent, int DalayTime, char* comment, bool optimize,
+                 int imMax=-1);  // largest pixel value, if already known
+
+  // color quantization of true-color (0xRRGGBB) pixels, see GifQuant.cpp
+  int  QuantizeColors(const int *rgb, long nPixel, int nColor, int *ColorMap);
+  void MapColors(const int *rgb, int Width, int Height, int nBand, 
+                 const int *ColorMap, int nColor, bool dither, int transparent,
+                 uchar *data);
 }
 #endif
               
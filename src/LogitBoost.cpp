@@ -0,0 +1,468 @@
+/*===========================================================================*/
+/* LogitBoost - boosting with decision stumps as weak learners               */
+/* Copyright (C) 2005 Jarek Tuszynski                                        */
+/* Distributed under GNU General Public License version 3                    */
+/*===========================================================================*/
+/*                                                                           */
+/* Parts of LogitBoostReg which are done for every feature: sorting or      */
+/* binning of the columns of the training data and search for the best      */
+/* decision stump; training of many classes at once and prediction.         */
+/*===========================================================================*/
+
+#include <R.h>
+#include <Rinternals.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+extern "C" {
+  #define Error Rf_error
+
+  typedef struct {
+    const double *x;
+    bool operator()(int a, int b) const { return x[a] < x[b]; }
+  } LbLess;
+
+  typedef struct {     // training data prepared by lbsort or lbbin
+    int nR, nF, nBin;  // number of samples, features and bins (0 if sorted)
+    const double *x;   // training data, NA's changed to +Inf
+    const double *thresh; // sorted columns, or upper bounds of bins
+    const int    *index;  // 1-based positions of elements of thresh
+    const Rbyte  *bin;    // bin of each sample
+  } LbData;
+
+  typedef struct {     // one decision stump used by lbpredict
+    int feat, chain;
+    double thresh;
+    int sign;
+  } LbStump;
+
+  typedef struct {
+    bool operator()(const LbStump &a, const LbStump &b) const 
+    { return a.feat < b.feat || (a.feat==b.feat && a.chain < b.chain); }
+  } LbStumpLess;
+
+  SEXP lbsort(SEXP X)
+  { // sort each column of X (NA's last). Returns list of sorted columns
+    // (Thresh) and original positions of their elements (1-based Index),
+    // ties in their original order, same as R's sort(x, index=TRUE)
+    int nR = Rf_nrows(X), nC = Rf_ncols(X), i, j;
+    const double *x = REAL(X);
+    SEXP Ret, Thresh, Index;
+    PROTECT(Ret = Rf_allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(Ret, 0, Thresh = Rf_allocMatrix(REALSXP, nR, nC));
+    SET_VECTOR_ELT(Ret, 1, Index  = Rf_allocMatrix(INTSXP,  nR, nC));
+    double *thresh = REAL(Thresh);
+    int    *index  = INTEGER(Index);
+    #pragma omp parallel for private(i) schedule(dynamic, 16) if ((double) nR*nC > 10000)
+    for (j=0; j<nC; j++) {
+      const double *xj = x + (long long) j*nR;
+      double *t = thresh + (long long) j*nR;
+      int    *idx = index + (long long) j*nR;
+      for (i=0; i<nR; i++) idx[i] = i;
+      LbLess less = {xj};
+      std::stable_sort(idx, idx+nR, less);
+      for (i=0; i<nR; i++) {
+        t[i] = (ISNAN(xj[idx[i]]) ? R_PosInf : xj[idx[i]]);
+        idx[i]++;
+      }
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+
+  static LbData LbGetData(SEXP X, SEXP Thresh, SEXP Index)
+  { // Thresh holds thresholds: sorted columns from lbsort or bin upper bounds
+    // (Cut) from lbbin. Index holds positions of samples: their sorted order 
+    // or their raw bins (Bin)
+    LbData D;
+    D.x = (Rf_isNull(X) ? NULL : REAL(X));
+    D.nR = Rf_nrows(Index);
+    D.nF = Rf_ncols(Index);
+    if (TYPEOF(Index)==RAWSXP) {
+      D.nBin   = Rf_nrows(Thresh);
+      D.bin    = RAW(Index);
+      D.thresh = REAL(Thresh);
+      D.index  = NULL;
+    } else {
+      D.nBin   = 0;
+      D.bin    = NULL;
+      D.thresh = REAL(Thresh);
+      D.index  = INTEGER(Index);
+    }
+    return D;
+  }
+
+  //----------------------------------------------------------------------
+  // Best decision stump of one feature, same as the body of the loop over
+  // features in LogitBoostReg. LS, the cumulative sum of wz in sorted order,
+  // is found in a single pass, and its first maximum and minimum at the last
+  // element of each run of equal thresholds. LS is accumulated in long
+  // double, the same as R's cumsum, so the stumps are identical.
+  // For binned data wz is first summed into bins in one pass over the
+  // samples, and LS is the cumulative sum over bins, so there are only nBin
+  // thresholds to try.
+  //----------------------------------------------------------------------
+  static void LbFeature(const LbData *D, int j, const double *wz, double ls1, 
+                        double ls2, double *best, int *pos, int *sign)
+  {
+    int i, iMax = -1, iMin = -1, nR = D->nR;
+    long double sum = 0;
+    double LS, Max = 0, Min = 0;
+    if (D->nBin) {
+      const Rbyte  *b = D->bin    + (long long) j*nR;
+      const double *c = D->thresh + (long long) j*D->nBin;
+      long double hist[256];     // as exact as LS of sorted data
+      int nb = 0;
+      while (nb<D->nBin && !ISNAN(c[nb])) nb++;
+      for (i=0; i<nb; i++) hist[i] = 0;
+      for (i=0; i<nR; i++) hist[b[i]] += wz[i];
+      for (i=0; i<nb; i++) {
+        sum += hist[i];
+        LS = (double) sum;
+        if (iMax<0 || LS>Max) { Max = LS; iMax = i; }
+        if (iMin<0 || LS<Min) { Min = LS; iMin = i; }
+      }
+    } else {
+      const double *t   = D->thresh + (long long) j*nR;
+      const int    *idx = D->index  + (long long) j*nR;
+      for (i=0; i<nR; i++) {
+        sum += wz[idx[i]-1];
+        if (i<nR-1 && !(t[i]!=t[i+1])) continue;   // not last of equal ones
+        LS = (double) sum;
+        if (iMax<0 || LS>Max) { Max = LS; iMax = i; }
+        if (iMin<0 || LS<Min) { Min = LS; iMin = i; }
+      }
+    }
+    double v1 = ls1-Max, v2 = ls2+Min;
+    if (v2<v1) { best[j] = v2; pos[j] = iMin; sign[j] = -1; }
+    else       { best[j] = v1; pos[j] = iMax; sign[j] =  1; }
+  }
+
+  //----------------------------------------------------------------------
+  // Best decision stump of one iteration. Features are split between
+  // threads (unless already called from a parallel region) and the best
+  // one is picked in feature order, with ties going to the first one.
+  // Returns false if no stump is better than the initial max(ls1, ls2).
+  //----------------------------------------------------------------------
+  static bool LbSearch(const LbData *D, const double *wz, double ls1, double ls2, 
+                       int jFeat, double *best, int *pos, int *sign, double *stump)
+  {
+    int j, nF = D->nF;
+    #pragma omp parallel for schedule(static) if ((double) D->nR*nF > 10000)
+    for (j=0; j<nF; j++) LbFeature(D, j, wz, ls1, ls2, best, pos, sign);
+    double MinLS = (ls1>ls2 ? ls1 : ls2);
+    int iFeat = -1;
+    for (j=0; j<nF; j++)
+      if (j!=jFeat && MinLS>best[j]) { MinLS = best[j]; iFeat = j; }
+    if (iFeat<0) return false;
+    stump[0] = iFeat+1;
+    stump[1] = (D->nBin ? D->thresh[(long long) iFeat*D->nBin + pos[iFeat]]
+                        : D->thresh[(long long) iFeat*D->nR   + pos[iFeat]]);
+    stump[2] = sign[iFeat];
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  // Probabilities of all classes of one sample from sums of outputs of 
+  // stumps of each chain (f, with stride fs), stored in p (with stride ps).
+  // Returns 1-based label of the most probable class or NA in case of ties.
+  //----------------------------------------------------------------------
+  static int LbProb(const int *f, long long fs, int nChain, double *p, long long ps)
+  {
+    int c, iMax = 0, nMax = 0, nClass = (nChain==1 ? 2 : nChain);
+    double Max = -1;
+    if (nChain==1) {
+      double q = 1/(1+exp(-(double) f[0]));
+      p[0]  = 1-q;   // probability that sample belongs to class 1
+      p[ps] = q;     // probability that sample belongs to class 2
+    } else for (c=0; c<nChain; c++)  // probability of class c against the rest
+      p[c*ps] = 1-1/(1+exp(-(double) f[c*fs]));
+    for (c=0; c<nClass; c++) {
+      double v = p[c*ps];
+      if (v>Max) { Max = v; iMax = c; nMax = 1; }
+      else if (v==Max) nMax++;
+    }
+    return (nMax>1 ? NA_INTEGER : iMax+1);
+  }
+
+  //----------------------------------------------------------------------
+  // 2-class boosting of one chain, one iteration at a time, the same as the
+  // loop over iterations in LogitBoostReg, including the order of 
+  // operations, so the stumps are identical. Uses only malloc so chains can
+  // be trained by different threads.
+  //----------------------------------------------------------------------
+  typedef struct {
+    double *f, *p, *w, *z, *wz;  // per sample
+    double *best;                // per feature
+    int *pos, *sign, jFeat;
+    double last[3];              // last stump
+  } LbChain;
+
+  static void LbChainInit(LbChain *C, int nR, int nF)
+  { // R_alloc'ed, so nothing leaks if training is interrupted
+    C->f  = (double*) R_alloc(5*(size_t) nR, sizeof(double));
+    C->p  = C->f + nR; C->w = C->p + nR; C->z = C->w + nR; C->wz = C->z + nR;
+    C->best = (double*) R_alloc((size_t) nF, sizeof(double));
+    C->pos  = (int*)    R_alloc(2*(size_t) nF, sizeof(int));
+    C->sign = C->pos + nF;
+    C->jFeat = -1;
+    for (int i=0; i<nR; i++) { C->f[i] = 0; C->p[i] = 0.5; }
+  }
+
+  static bool LbChainStep(const LbData *D, const double *y, LbChain *C, double *stump)
+  { // if no stump was found the last one is used again, as in LogitBoostReg.
+    // Returns false if no stump was found in the first iteration
+    int i, nR = D->nR;
+    double *f = C->f, *p = C->p, *w = C->w, *z = C->z, *wz = C->wz;
+    long double sum = 0, sum1 = 0, sum2 = 0;
+    for (i=0; i<nR; i++) {            // w = pmax(p*(1-p), 1e-24)
+      w[i] = p[i]*(1-p[i]);
+      if (w[i]<1e-24) w[i] = 1e-24;
+      z[i] = (y[i]-p[i])/w[i];
+      sum += w[i];
+    }
+    double sw = (double) sum;
+    for (i=0; i<nR; i++) {            // w = w/sum(w)
+      w[i] = w[i]/sw;
+      sum1 += w[i]*((z[i]+1)*(z[i]+1));
+      sum2 += w[i]*((z[i]-1)*(z[i]-1));
+      wz[i] = 4*w[i]*z[i];
+    }
+    if (!LbSearch(D, wz, (double) sum1, (double) sum2, C->jFeat, C->best, C->pos, C->sign, stump)) {
+      if (C->jFeat<0) return false;
+      for (i=0; i<3; i++) stump[i] = C->last[i];
+    }
+    for (i=0; i<3; i++) C->last[i] = stump[i];
+    C->jFeat = (int) stump[0] - 1;
+    const double *x = D->x + (long long) C->jFeat*nR;
+    for (i=0; i<nR; i++) {
+      f[i] += stump[2] * (x[i]<=stump[1] ? 1.0 : -1.0);
+      p[i] = 1/(1+exp(-f[i]));
+    }
+    return true;
+  }
+
+  SEXP lbstump(SEXP Thresh, SEXP Index, SEXP WZ, SEXP LS12, SEXP JFeat)
+  { // Thresh (sorted columns or Cut) and Index (order or Bin) from lbsort or
+    // lbbin. Returns c(feature, threshold,
+    // sign) or NA if no stump is better than the initial max(ls1, ls2)
+    LbData D = LbGetData(R_NilValue, Thresh, Index);
+    double *best = (double*) R_alloc(D.nF, sizeof(double));  // best LS of a feature
+    int    *pos  = (int*)    R_alloc(D.nF, sizeof(int));     // its threshold
+    int    *sign = (int*)    R_alloc(D.nF, sizeof(int));
+    SEXP Ret;
+    PROTECT(Ret = Rf_allocVector(REALSXP, 3));
+    if (!LbSearch(&D, REAL(WZ), REAL(LS12)[0], REAL(LS12)[1], Rf_asInteger(JFeat)-1, 
+                  best, pos, sign, REAL(Ret)))
+      REAL(Ret)[0] = REAL(Ret)[1] = REAL(Ret)[2] = NA_REAL;
+    UNPROTECT(1);
+    return Ret;
+  }
+
+  SEXP lbtrain(SEXP X, SEXP Thresh, SEXP Index, SEXP Y, SEXP NIter, 
+               SEXP XVal, SEXP YVal, SEXP Patience)
+  { // one-vs-rest training of each column of Y (0/1 labels), all using the 
+    // same sorted or binned data. Chains do each iteration at the same time,
+    // each one by a different thread. If validation data (XVal with NA's 
+    // changed to +Inf, YVal with 1-based classes) is given, its error is 
+    // found after each iteration and training stops when it did not improve
+    // for Patience iterations. Returns list of Stump matrices of all chains
+    // cbind'ed (up to the iteration with the smallest validation error) and
+    // vector of validation errors (or NULL).
+    LbData D = LbGetData(X, Thresh, Index);
+    int nChain = Rf_ncols(Y), nIter = Rf_asInteger(NIter), i, j, m, nFail = 0;
+    int nVal = (Rf_isNull(XVal) ? 0 : Rf_nrows(XVal)), patience = Rf_asInteger(Patience);
+    int nClass = (nChain==1 ? 2 : nChain), nDone = 0, mBest = 0, nThread = 1;
+    const double *y = REAL(Y), *xv = (nVal ? REAL(XVal) : NULL);
+    const int    *yv = (nVal ? INTEGER(YVal) : NULL);
+    if (Rf_nrows(Y)!=D.nR) Error("lbtrain: wrong number of labels");
+    if (nVal && (Rf_ncols(XVal)!=D.nF || LENGTH(YVal)!=nVal)) 
+      Error("lbtrain: validation data does not match training data");
+    double *stump = (double*) R_alloc((size_t) 3*nChain*nIter+1, sizeof(double));
+    double *error = (double*) R_alloc((size_t) nIter+1, sizeof(double));
+    int    *fv    = (int*)    R_alloc((size_t) nChain*nVal+1, sizeof(int));   // sums of outputs
+    double *pv    = (double*) R_alloc((size_t) nClass*nVal+1, sizeof(double)); // probabilities
+    LbChain *chain = (LbChain*) R_alloc(nChain, sizeof(LbChain));
+    for (j=0; j<nChain; j++) LbChainInit(chain+j, D.nR, D.nF);
+    for (i=0; i<nChain*nVal; i++) fv[i] = 0;
+#ifdef _OPENMP
+    nThread = omp_get_max_threads();
+#endif
+    for (m=0; m<nIter; m++) {
+      R_CheckUserInterrupt();
+      // chains run in parallel only if there are enough of them to keep all 
+      // threads busy, otherwise they run in turn, each splitting its features
+      #pragma omp parallel for schedule(dynamic, 1) reduction(+:nFail) if (nChain>1 && nChain>=nThread)
+      for (j=0; j<nChain; j++) {
+        double st[3];
+        if (!LbChainStep(&D, y + (long long) j*D.nR, chain+j, st)) { nFail++; continue; }
+        for (int k=0; k<3; k++) stump[(long long) (3*j+k)*nIter + m] = st[k];
+      }
+      if (nFail) break;
+      nDone = m+1;
+      if (!nVal) continue;
+      int nErr = 0;
+      #pragma omp parallel for reduction(+:nErr) if ((double) nVal*nChain > 10000)
+      for (i=0; i<nVal; i++) {        // add the new stumps to validation sums
+        for (int c=0; c<nChain; c++) {
+          long long k = (long long) 3*c*nIter + m;
+          double x = xv[(long long) ((int) stump[k]-1)*nVal + i];
+          fv[(long long) c*nVal + i] += (int) stump[k+2*nIter] * (x<=stump[k+nIter] ? 1 : -1);
+        }
+        int label = LbProb(fv + i, nVal, nChain, pv + (long long) i*nClass, 1);
+        if (label==NA_INTEGER || label!=yv[i]) nErr++;
+      }
+      error[m] = (double) nErr/nVal;
+      if (error[m]<error[mBest]) mBest = m;        // new smallest error
+      else if (m-mBest>=patience) break;           // no improvement for a while
+    }
+    int nKeep = (nVal && nDone ? mBest+1 : nDone);
+    if (nFail) Error("lbtrain: no decision stump found for %d classes", nFail);
+    SEXP Ret, Stump, Err;
+    PROTECT(Ret = Rf_allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(Ret, 0, Stump = Rf_allocMatrix(REALSXP, nKeep, 3*nChain));
+    for (j=0; j<3*nChain; j++) for (m=0; m<nKeep; m++)
+      REAL(Stump)[(long long) j*nKeep + m] = stump[(long long) j*nIter + m];
+    if (nVal) {
+      SET_VECTOR_ELT(Ret, 1, Err = Rf_allocVector(REALSXP, nDone));
+      for (m=0; m<nDone; m++) REAL(Err)[m] = error[m];
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+
+  //----------------------------------------------------------------------
+  // Binned version: each column is quantized once into at most nBin bins,
+  // stored in one byte per sample. Bin b holds values in (Cut[b-1], Cut[b]]
+  // where cuts are values of the column at its quantiles, so thresholds are
+  // always real data values. If a column has no more than nBin distinct
+  // values each of them gets its own bin and the search is exact.
+  //----------------------------------------------------------------------
+  SEXP lbbin(SEXP X, SEXP NBin)
+  { // returns list of Bin (raw matrix of 0-based bin numbers) and Cut
+    // (nBin x nCol matrix of upper bounds of bins, NA padded)
+    int nR = Rf_nrows(X), nC = Rf_ncols(X), nBin = Rf_asInteger(NBin), j;
+    const double *x = REAL(X);
+    if (nBin<2 || nBin>256) Error("lbbin: number of bins has to be in 2..256");
+    SEXP Ret, Bin, Cut;
+    PROTECT(Ret = Rf_allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(Ret, 0, Bin = Rf_allocMatrix(RAWSXP,  nR, nC));
+    SET_VECTOR_ELT(Ret, 1, Cut = Rf_allocMatrix(REALSXP, nBin, nC));
+    Rbyte  *bin = RAW(Bin);
+    double *cut = REAL(Cut);
+    #pragma omp parallel for schedule(dynamic, 16) if ((double) nR*nC > 10000)
+    for (j=0; j<nC; j++) {
+      const double *xj = x + (long long) j*nR;
+      double *c = cut + (long long) j*nBin;
+      Rbyte  *b = bin + (long long) j*nR;
+      double *v = (double*) malloc(((size_t) nR+1)*sizeof(double));
+      int i, k, n=0, nCut=0;
+      for (i=0; i<nR; i++) v[i] = (ISNAN(xj[i]) ? R_PosInf : xj[i]);
+      std::sort(v, v+nR);
+      for (i=0; i<nR; i++) if (i==0 || v[i]!=v[i-1]) v[n++] = v[i]; // distinct values
+      if (n<=nBin) {                       // every value gets its own bin
+        for (k=0; k<n; k++) c[nCut++] = v[k];
+      } else {                             // bins of about the same size
+        for (i=0; i<nR; i++) v[i] = (ISNAN(xj[i]) ? R_PosInf : xj[i]);
+        std::sort(v, v+nR);
+        for (k=1; k<=nBin; k++) {
+          double t = v[(int) (((long long) k*nR)/nBin) - 1];
+          if (nCut==0 || t>c[nCut-1]) c[nCut++] = t;
+        }
+      }
+      for (k=nCut; k<nBin; k++) c[k] = NA_REAL;
+      for (i=0; i<nR; i++) {               // first cut not smaller than x
+        double t = (ISNAN(xj[i]) ? R_PosInf : xj[i]);
+        b[i] = (Rbyte) (std::lower_bound(c, c+nCut, t) - c);
+      }
+      free(v);
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+
+
+  //----------------------------------------------------------------------
+  // Prediction: all stumps of all classes are grouped by feature and the
+  // data is processed in blocks of rows, so each column of a block is read
+  // once for all stumps using it, and each stump is a simple loop over the
+  // block that compilers turn into vector compares. Sums of stump outputs
+  // are integers, so the order of stumps does not change the result.
+  // In cumulative mode stumps are used in order of iterations, and results
+  // are stored after each iteration, so predictions for every number of 
+  // iterations are found in a single pass.
+  //----------------------------------------------------------------------
+  #define LB_BLOCK 512
+
+  SEXP lbpredict(SEXP X, SEXP Stump, SEXP NIter, SEXP Cumulative)
+  { // returns list of Prob (nTest x nClass matrix) and 1-based Label of the
+    // most probable class, or NA in case of ties. In cumulative mode Prob is
+    // nTest x nClass x nIter array and Label nTest x nIter matrix
+    int nR = Rf_nrows(X), nC = Rf_ncols(X), nIter = Rf_asInteger(NIter);
+    int nIt = Rf_nrows(Stump), nChain = Rf_ncols(Stump)/3, nStump = 0, i, j;
+    int nClass = (nChain==1 ? 2 : nChain), cumul = Rf_asLogical(Cumulative);
+    const double *x = REAL(X), *st = REAL(Stump);
+    if (nIter>nIt || nIter<0) nIter = nIt;
+    LbStump *stump = (LbStump*) R_alloc((size_t) nIter*nChain+1, sizeof(LbStump));
+    for (i=0; i<nIter; i++) for (j=0; j<nChain; j++) { // in order of iterations
+      LbStump s;
+      s.feat   = (int) st[(long long) 3*j*nIt + i] - 1;
+      s.thresh = st[(long long) (3*j+1)*nIt + i];
+      s.sign   = (st[(long long) (3*j+2)*nIt + i] < 0 ? -1 : 1);
+      s.chain  = j;
+      if (s.feat<0 || s.feat>=nC) Error("lbpredict: stump uses feature %d, data has %d columns", s.feat+1, nC);
+      stump[nStump++] = s;
+    }
+    if (!cumul) std::sort(stump, stump+nStump, LbStumpLess());
+    SEXP Ret, Prob, Label;
+    PROTECT(Ret = Rf_allocVector(VECSXP, 2));
+    if (cumul) {
+      SET_VECTOR_ELT(Ret, 0, Prob  = Rf_alloc3DArray(REALSXP, nR, nClass, nIter));
+      SET_VECTOR_ELT(Ret, 1, Label = Rf_allocMatrix(INTSXP, nR, nIter));
+    } else {
+      SET_VECTOR_ELT(Ret, 0, Prob  = Rf_allocMatrix(REALSXP, nR, nClass));
+      SET_VECTOR_ELT(Ret, 1, Label = Rf_allocVector(INTSXP, nR));
+    }
+    double *prob  = REAL(Prob);
+    int    *label = INTEGER(Label);
+    int nBlock = (nR+LB_BLOCK-1)/LB_BLOCK;
+    #pragma omp parallel if ((double) nR*nStump > 100000)
+    {
+      int    *f   = (int*)    malloc((size_t) nChain*LB_BLOCK*sizeof(int));
+      double *col = (double*) malloc(LB_BLOCK*sizeof(double));
+      int iBlock;
+      #pragma omp for schedule(static)
+      for (iBlock=0; iBlock<nBlock; iBlock++) {
+        int r, k, r0 = iBlock*LB_BLOCK, nB = (nR-r0<LB_BLOCK ? nR-r0 : LB_BLOCK);
+        for (k=0; k<nChain*LB_BLOCK; k++) f[k] = 0;
+        for (k=0; k<nStump; ) {
+          int feat = stump[k].feat;
+          const double *xc = x + (long long) feat*nR + r0;
+          for (r=0; r<nB; r++) col[r] = (ISNAN(xc[r]) ? R_PosInf : xc[r]);
+          for (; r<LB_BLOCK; r++) col[r] = 0;  // full blocks vectorize better
+          do {
+            const double t = stump[k].thresh;
+            const int    s = stump[k].sign;
+            int *fc = f + stump[k].chain*LB_BLOCK;
+            for (r=0; r<LB_BLOCK; r++) fc[r] += (col[r]<=t ? s : -s);
+            k++;
+          } while (k<nStump && stump[k].feat==feat && !cumul);
+          if (cumul && k%nChain==0) {           // all chains did iteration k/nChain
+            long long m = k/nChain-1;
+            for (r=0; r<nB; r++) 
+              label[r0+r + m*nR] = LbProb(f+r, LB_BLOCK, nChain, prob + r0+r + m*nR*nClass, nR);
+          }
+        }
+        if (!cumul) for (r=0; r<nB; r++) 
+          label[r0+r] = LbProb(f+r, LB_BLOCK, nChain, prob + r0+r, nR);
+      }
+      free(f); free(col);
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+}
@@ -9,7 +9,6 @@
 
 /* .C calls */
 extern void cumsum_exact(void *, void *, void *);
-extern void imwritegif(void *, void *, void *, void *, void *);
 extern void runmad(void *, void *, void *, void *, void *);
 extern void runmax(void *, void *, void *, void *);
 extern void runmean(void *, void *, void *, void *);
@@ -21,11 +20,39 @@ extern void runsd(void *, void *, void *, void *, void *);
 extern void sum_exact(void *, void *, void *);
 
 /* .Call calls */
-extern SEXP imreadgif(SEXP, SEXP, SEXP);
+extern SEXP aucbins(SEXP, SEXP, SEXP, SEXP);
+extern SEXP aucmerge(SEXP, SEXP);
+extern SEXP aucvalue(SEXP);
+extern SEXP b64decode(SEXP);
+extern SEXP b64decodechunk(SEXP, SEXP, SEXP);
+extern SEXP b64encode(SEXP);
+extern SEXP b64encodechunk(SEXP, SEXP, SEXP);
+extern SEXP colauc(SEXP, SEXP, SEXP);
+extern SEXP colroc(SEXP, SEXP, SEXP, SEXP);
+extern SEXP enviclose(SEXP);
+extern SEXP envihdr(SEXP);
+extern SEXP envinext(SEXP);
+extern SEXP enviopen(SEXP, SEXP);
+extern SEXP enviread(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP envitiles(SEXP, SEXP, SEXP);
+extern SEXP envitilesclose(SEXP);
+extern SEXP enviwrite(SEXP, SEXP, SEXP);
+extern SEXP gifaddframe(SEXP, SEXP);
+extern SEXP gifclose(SEXP);
+extern SEXP gifindex(SEXP, SEXP);
+extern SEXP gifopen(SEXP, SEXP, SEXP, SEXP);
+extern SEXP gifrange(SEXP);
+extern SEXP gifwrite(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP gifwritergb(SEXP, SEXP, SEXP, SEXP);
+extern SEXP imreadgif(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP lbbin(SEXP, SEXP);
+extern SEXP lbpredict(SEXP, SEXP, SEXP, SEXP);
+extern SEXP lbsort(SEXP);
+extern SEXP lbstump(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP lbtrain(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 
 static const R_CMethodDef CEntries[] = {
     {"cumsum_exact",  (DL_FUNC) &cumsum_exact,  3},
-    {"imwritegif",    (DL_FUNC) &imwritegif,    5},
     {"runmad",        (DL_FUNC) &runmad,        5},
     {"runmax",        (DL_FUNC) &runmax,        4},
     {"runmean",       (DL_FUNC) &runmean,       4},
@@ -39,7 +66,36 @@ static const R_CMethodDef CEntries[] = {
 };
 
 static const R_CallMethodDef CallEntries[] = {
-    {"imreadgif", (DL_FUNC) &imreadgif, 3},
+    {"aucbins",        (DL_FUNC) &aucbins,        4},
+    {"aucmerge",       (DL_FUNC) &aucmerge,       2},
+    {"aucvalue",       (DL_FUNC) &aucvalue,       1},
+    {"b64decode",      (DL_FUNC) &b64decode,      1},
+    {"b64decodechunk", (DL_FUNC) &b64decodechunk, 3},
+    {"b64encode",      (DL_FUNC) &b64encode,      1},
+    {"b64encodechunk", (DL_FUNC) &b64encodechunk, 3},
+    {"colauc",         (DL_FUNC) &colauc,         3},
+    {"colroc",         (DL_FUNC) &colroc,         4},
+    {"enviclose",      (DL_FUNC) &enviclose,      1},
+    {"envihdr",        (DL_FUNC) &envihdr,        1},
+    {"envinext",       (DL_FUNC) &envinext,       1},
+    {"enviopen",       (DL_FUNC) &enviopen,       2},
+    {"enviread",       (DL_FUNC) &enviread,       5},
+    {"envitiles",      (DL_FUNC) &envitiles,      3},
+    {"envitilesclose", (DL_FUNC) &envitilesclose, 1},
+    {"enviwrite",      (DL_FUNC) &enviwrite,      3},
+    {"gifaddframe",    (DL_FUNC) &gifaddframe,    2},
+    {"gifclose",       (DL_FUNC) &gifclose,       1},
+    {"gifindex",       (DL_FUNC) &gifindex,       2},
+    {"gifopen",        (DL_FUNC) &gifopen,        4},
+    {"gifrange",       (DL_FUNC) &gifrange,       1},
+    {"gifwrite",       (DL_FUNC) &gifwrite,       5},
+    {"gifwritergb",    (DL_FUNC) &gifwritergb,    4},
+    {"imreadgif",      (DL_FUNC) &imreadgif,      6},
+    {"lbbin",          (DL_FUNC) &lbbin,          2},
+    {"lbpredict",      (DL_FUNC) &lbpredict,      4},
+    {"lbsort",         (DL_FUNC) &lbsort,         1},
+    {"lbstump",        (DL_FUNC) &lbstump,        5},
+    {"lbtrain",        (DL_FUNC) &lbtrain,        8},
     {NULL, NULL, 0}
 };
 
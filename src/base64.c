@@ -0,0 +1,504 @@
+/*===========================================================================*/
+/* base64 - Base64 encoder and decoder working on raw vectors               */
+/* Copyright (C) 2005 Jarek Tuszynski                                        */
+/* Distributed under GNU General Public License version 3                    */
+/*===========================================================================*/
+
+/*==================================================*/
+/* Every 3 bytes of input (24 bits) become 4        */
+/* characters of output (6 bits each):              */
+/*   x = aaaaaabb bbbbcccc ccdddddd                 */
+/*   y = 00aaaaaa 00bbbbbb 00cccccc 00dddddd        */
+/* and y is mapped to [A-Z,a-z,0-9,+,/]. The scalar */
+/* code is table driven; on x86 the bulk of the     */
+/* data goes through SSSE3 or AVX2 kernels chosen   */
+/* at run time, 12 or 24 bytes per step. Any block  */
+/* the vector decoder can not handle (padding or    */
+/* invalid characters) is left to the scalar code.  */
+/*==================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <R.h>
+#include <Rinternals.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define B64_SIMD
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+
+typedef unsigned char uchar;
+
+typedef struct {      /* decoder state between calls */
+  unsigned int bits;  /* 6 bit values of incomplete group */
+  int n;              /* number of them: 0-3 */
+  int space;          /* skip white space (line breaks) ? */
+} b64state;
+
+static const char B64Alphabet[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* character -> 6 bit value; 64 for padding '=', -1 for anything else */
+static const signed char B64Value[256] = {
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+  52,53,54,55,56,57,58,59,60,61,-1,-1,-1,64,-1,-1,
+  -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+  15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+  -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+  41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+/*==================================================================*/
+/* Run time selection of the vector kernels                         */
+/*==================================================================*/
+
+static int B64Level = -1;   /* 0 - scalar, 1 - SSSE3, 2 - AVX2 */
+
+static int b64_level(void)
+{
+  if (B64Level<0) {
+    B64Level = 0;
+#ifdef B64_SIMD
+    __builtin_cpu_init();
+    if      (__builtin_cpu_supports("avx2" )) B64Level = 2;
+    else if (__builtin_cpu_supports("ssse3")) B64Level = 1;
+#endif
+  }
+  return B64Level;
+}
+
+#ifdef B64_SIMD
+/*==================================================================*/
+/* SSSE3 kernels                                                    */
+/*==================================================================*/
+
+/* 6 bit values -> ASCII: find per byte offset to add using pshufb */
+TARGET_SSSE3 static __m128i enc_translate_ssse3(__m128i in)
+{
+  const __m128i shift = _mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52,
+    '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62,
+    '/'-63, 'A', 0, 0);
+  __m128i idx  = _mm_subs_epu8(in, _mm_set1_epi8(51));      /* 52..63 -> 1..12 */
+  __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);     /* 0..25  -> 13    */
+  idx = _mm_or_si128(idx, _mm_and_si128(less, _mm_set1_epi8(13)));
+  return _mm_add_epi8(in, _mm_shuffle_epi8(shift, idx));
+}
+
+/* spread 12 bytes into 16 bytes of 6 bit values */
+TARGET_SSSE3 static __m128i enc_reshuffle_ssse3(__m128i in)
+{
+  __m128i t0, t1, t2, t3;
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10,11,9,10, 7,8,6,7, 4,5,3,4, 1,2,0,1));
+  t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t1, t3);
+}
+
+TARGET_SSSE3 static size_t encode_ssse3(const uchar *in, size_t n, char *out)
+{
+  size_t i=0;
+  for (; i+16<=n; i+=12, out+=16) {  /* 16 bytes loaded, 12 used */
+    __m128i x = _mm_loadu_si128((const __m128i*) (in+i));
+    _mm_storeu_si128((__m128i*) out, enc_translate_ssse3(enc_reshuffle_ssse3(x)));
+  }
+  return i;
+}
+
+/* ASCII -> 6 bit values; returns 0 if any of the characters is not in the
+ * alphabet (this includes padding) */
+TARGET_SSSE3 static int dec_translate_ssse3(__m128i *str)
+{
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+    0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+    0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2F = _mm_set1_epi8(0x2f);
+  __m128i hi_nib = _mm_and_si128(_mm_srli_epi32(*str, 4), mask_2F);
+  __m128i lo_nib = _mm_and_si128(*str, mask_2F);
+  __m128i lo     = _mm_shuffle_epi8(lut_lo, lo_nib);
+  __m128i hi     = _mm_shuffle_epi8(lut_hi, hi_nib);
+  __m128i eq_2F  = _mm_cmpeq_epi8(*str, mask_2F);
+  __m128i bad    = _mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+  if (_mm_movemask_epi8(bad)) return 0;
+  *str = _mm_add_epi8(*str, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2F, hi_nib)));
+  return 1;
+}
+
+/* pack 16 6-bit values into 12 bytes (followed by 4 zero bytes) */
+TARGET_SSSE3 static __m128i dec_reshuffle_ssse3(__m128i in)
+{
+  __m128i ab_bc = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+  __m128i out   = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(out, _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12,
+    -1,-1,-1,-1));
+}
+
+TARGET_SSSE3 static size_t decode_ssse3(const char *in, size_t n, uchar *out,
+  size_t nOut)
+{
+  size_t i=0, j=0;
+  for (; i+16<=n && j+16<=nOut; i+=16, j+=12) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (in+i));
+    if (!dec_translate_ssse3(&x)) break;
+    _mm_storeu_si128((__m128i*) (out+j), dec_reshuffle_ssse3(x));
+  }
+  return i;
+}
+
+/*==================================================================*/
+/* AVX2 kernels - the same as SSSE3 ones, two lanes at a time       */
+/*==================================================================*/
+
+TARGET_AVX2 static __m256i enc_translate_avx2(__m256i in)
+{
+  const __m256i shift = _mm256_setr_epi8(
+    'a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+    '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0,
+    'a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+    '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+  __m256i idx  = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+  __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), in);
+  idx = _mm256_or_si256(idx, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+  return _mm256_add_epi8(in, _mm256_shuffle_epi8(shift, idx));
+}
+
+TARGET_AVX2 static __m256i enc_reshuffle_avx2(__m256i in)
+{
+  __m256i t0, t1, t2, t3;
+  in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+    10,11,9,10, 7,8,6,7, 4,5,3,4, 1,2,0,1,
+    10,11,9,10, 7,8,6,7, 4,5,3,4, 1,2,0,1));
+  t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+  t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+  t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+  t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+  return _mm256_or_si256(t1, t3);
+}
+
+TARGET_AVX2 static size_t encode_avx2(const uchar *in, size_t n, char *out)
+{
+  size_t i=0;
+  for (; i+28<=n; i+=24, out+=32) {  /* each lane gets 12 of its 16 bytes */
+    __m128i lo = _mm_loadu_si128((const __m128i*) (in+i));
+    __m128i hi = _mm_loadu_si128((const __m128i*) (in+i+12));
+    __m256i x  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    _mm256_storeu_si256((__m256i*) out, enc_translate_avx2(enc_reshuffle_avx2(x)));
+  }
+  return i;
+}
+
+TARGET_AVX2 static int dec_translate_avx2(__m256i *str)
+{
+  const __m256i lut_lo = _mm256_setr_epi8(
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2F = _mm256_set1_epi8(0x2f);
+  __m256i hi_nib = _mm256_and_si256(_mm256_srli_epi32(*str, 4), mask_2F);
+  __m256i lo_nib = _mm256_and_si256(*str, mask_2F);
+  __m256i lo     = _mm256_shuffle_epi8(lut_lo, lo_nib);
+  __m256i hi     = _mm256_shuffle_epi8(lut_hi, hi_nib);
+  __m256i eq_2F  = _mm256_cmpeq_epi8(*str, mask_2F);
+  if (!_mm256_testz_si256(lo, hi)) return 0;
+  *str = _mm256_add_epi8(*str, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2F, hi_nib)));
+  return 1;
+}
+
+TARGET_AVX2 static __m256i dec_reshuffle_avx2(__m256i in)
+{
+  __m256i ab_bc = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+  __m256i out   = _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+  out = _mm256_shuffle_epi8(out, _mm256_setr_epi8(
+    2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1,
+    2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1));
+  /* move 12 bytes of the high lane next to 12 bytes of the low lane */
+  return _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0,1,2,4,5,6,3,7));
+}
+
+TARGET_AVX2 static size_t decode_avx2(const char *in, size_t n, uchar *out,
+  size_t nOut)
+{
+  size_t i=0, j=0;
+  for (; i+32<=n && j+32<=nOut; i+=32, j+=24) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (in+i));
+    if (!dec_translate_avx2(&x)) break;
+    _mm256_storeu_si256((__m256i*) (out+j), dec_reshuffle_avx2(x));
+  }
+  return i;
+}
+#endif
+
+/*==================================================================*/
+/* Encoder and decoder                                              */
+/*==================================================================*/
+
+static size_t b64_encode(const uchar *in, size_t n, char *out)
+{
+  /* Encode n bytes of 'in' into 4*ceil(n/3) characters of 'out', padded
+   * with '='. Returns number of characters written. */
+  size_t i=0, j=0;
+#ifdef B64_SIMD
+  int level = b64_level();
+  if (level==2) i = encode_avx2 (in, n, out);
+  if (level>=1) i += encode_ssse3(in+i, n-i, out+i/3*4);
+  j = i/3*4;
+#endif
+  for (; i+3<=n; i+=3) {
+    unsigned int x = (in[i]<<16) | (in[i+1]<<8) | in[i+2];
+    out[j++] = B64Alphabet[(x>>18)   ];
+    out[j++] = B64Alphabet[(x>>12)&63];
+    out[j++] = B64Alphabet[(x>> 6)&63];
+    out[j++] = B64Alphabet[(x    )&63];
+  }
+  if (i<n) {
+    unsigned int x = in[i]<<16;
+    if (i+1<n) x |= in[i+1]<<8;
+    out[j++] = B64Alphabet[(x>>18)   ];
+    out[j++] = B64Alphabet[(x>>12)&63];
+    out[j++] = (i+1<n ? B64Alphabet[(x>>6)&63] : '=');
+    out[j++] = '=';
+  }
+  return j;
+}
+
+static long b64_decode(b64state *s, const char *in, size_t n, uchar *out, size_t nOut)
+{
+  /* Decode n characters of 'in' into at most nOut bytes of 'out'. Padding
+   * characters are skipped wherever they are. Up to 3 characters of an
+   * incomplete group are carried in 's' to the next call; b64_finish
+   * flushes them. Returns number of bytes written, -1 if 'in' has a
+   * character outside of Base64 alphabet or -2 if 'out' is too short. */
+  size_t i=0, j=0, m, stop;
+  unsigned int bits = s->bits;
+  int k = s->n;
+#ifdef B64_SIMD
+  int level = b64_level();
+#endif
+  while (i<n) {
+#ifdef B64_SIMD
+    if (k==0) {  /* vector code works only on whole groups */
+      if (level==2) { m = decode_avx2 (in+i, n-i, out+j, nOut-j); i += m; j += m/4*3; }
+      if (level>=1) { m = decode_ssse3(in+i, n-i, out+j, nOut-j); i += m; j += m/4*3; }
+    }
+#endif
+    /* the scalar code takes over the block vector code could not handle
+     * (padding, line break, etc.) and returns at the next group boundary */
+    for (stop=i+32; i<n && (i<stop || k); i++) {
+      int v = B64Value[(uchar) in[i]];
+      if (v<0) {
+        if (s->space && (in[i]==' ' || in[i]=='\n' || in[i]=='\r' || in[i]=='\t')) continue;
+        return -1;
+      }
+      if (v==64) continue;
+      bits = (bits<<6) | v;
+      if (++k==4) {
+        if (j+3>nOut) return -2;
+        out[j++] = (uchar) (bits>>16);
+        out[j++] = (uchar) (bits>> 8);
+        out[j++] = (uchar) (bits    );
+        bits = k = 0;
+      }
+    }
+  }
+  s->bits = bits;
+  s->n    = k;
+  return (long) j;
+}
+
+static int b64_finish(b64state *s, uchar *out)
+{
+  /* Flush incomplete group: 2 or 3 characters give 1 or 2 bytes. A single
+   * leftover character is decoded as if followed by zeros, giving 3 bytes,
+   * as in the original R code. */
+  unsigned int bits = s->bits;
+  int n=0;
+  switch (s->n) {
+    case 1: out[n++] = (uchar) (bits<<2); out[n++] = 0; out[n++] = 0; break;
+    case 2: out[n++] = (uchar) (bits>>4); break;
+    case 3: out[n++] = (uchar) (bits>>10); out[n++] = (uchar) (bits>>2); break;
+  }
+  s->bits = s->n = 0;
+  return n;
+}
+
+/*==================================================================*/
+/* R interface                                                      */
+/*==================================================================*/
+
+SEXP b64encode(SEXP Raw)
+{
+  /* raw vector -> single Base64 string */
+  size_t n, nOut;
+  char *buf;
+  if (TYPEOF(Raw)!=RAWSXP) Rf_error("base64encode: raw vector expected");
+  n    = (size_t) XLENGTH(Raw);
+  nOut = (n+2)/3*4;
+  if (nOut > INT_MAX) Rf_error("base64encode: input too long for a single string");
+  buf  = R_alloc(nOut+1, 1);
+  b64_encode(RAW(Raw), n, buf);
+  return Rf_ScalarString(Rf_mkCharLen(buf, (int) nOut));
+}
+
+static long decode_strings(SEXP Str, uchar *out, size_t nOut)
+{
+  R_xlen_t i, nStr = XLENGTH(Str);
+  b64state s = {0, 0, 0};
+  uchar tail[3];
+  long j=0, m;
+  for (i=0; i<nStr; i++) {
+    SEXP z = STRING_ELT(Str, i);
+    m = b64_decode(&s, CHAR(z), (size_t) LENGTH(z), out+j, nOut-j);
+    if (m<0) return m;
+    j += m;
+  }
+  m = b64_finish(&s, tail);
+  if ((size_t) (j+m) > nOut) return -2;
+  memcpy(out+j, tail, m);
+  return j+m;
+}
+
+SEXP b64decode(SEXP Str)
+{
+  /* character vector -> raw vector; elements are concatenated */
+  R_xlen_t i, nStr;
+  size_t n=0, nPad=0, nOut;
+  long j;
+  SEXP Raw;
+  if (!Rf_isString(Str)) Rf_error("base64decode: Input argument 'z' is suppose to be a string");
+  nStr = XLENGTH(Str);
+  for (i=0; i<nStr; i++) {
+    const char *z = CHAR(STRING_ELT(Str, i));
+    size_t len = (size_t) LENGTH(STRING_ELT(Str, i));
+    n += len;
+    if (len) nPad = (z[len-1]!='=' ? 0 : (len>1 && z[len-2]=='=' ? 2 : 1));
+  }
+  /* Output size assuming padding only at the end. Interior padding makes
+   * the output shorter (it is trimmed afterwards) or, in odd cases, one
+   * group longer, in which case we decode again into a larger buffer. */
+  n -= nPad;
+  nOut = n/4*3 + (n%4==1 ? 3 : (n%4 ? n%4-1 : 0));
+  PROTECT(Raw = Rf_allocVector(RAWSXP, (R_xlen_t) nOut));
+  j = decode_strings(Str, RAW(Raw), nOut);
+  if (j==-2) {
+    nOut = n/4*3 + 3;
+    UNPROTECT(1);
+    PROTECT(Raw = Rf_allocVector(RAWSXP, (R_xlen_t) nOut));
+    j = decode_strings(Str, RAW(Raw), nOut);
+  }
+  if (j<0) Rf_error("base64decode: Input string is not in Base64 format");
+  if ((size_t) j<nOut) Raw = Rf_xlengthgets(Raw, (R_xlen_t) j);
+  UNPROTECT(1);
+  return Raw;
+}
+
+/*==================================================================*/
+/* Chunked interface used for streaming. Bytes (or characters) that */
+/* do not make a whole group, 0-3 of them, are returned to R and    */
+/* passed back with the next chunk, so files of any size can be     */
+/* converted in constant memory.                                    */
+/*==================================================================*/
+
+static SEXP chunk_result(SEXP Out, SEXP Rest)
+{
+  SEXP Ret;
+  PROTECT(Ret = Rf_allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(Ret, 0, Out);
+  SET_VECTOR_ELT(Ret, 1, Rest);
+  UNPROTECT(1);
+  return Ret;
+}
+
+SEXP b64encodechunk(SEXP Chunk, SEXP Left, SEXP Final)
+{
+  /* raw chunk -> list(raw vector of Base64 characters, leftover bytes) */
+  size_t i, j=0, m, n, nLeft, nTot, nRem, nEnc;
+  const uchar *in, *left;
+  uchar group[3];
+  SEXP Out, Rest, Ret;
+  if (TYPEOF(Chunk)!=RAWSXP || TYPEOF(Left)!=RAWSXP || XLENGTH(Left)>2)
+    Rf_error("base64encode: raw vector expected");
+  in    = RAW(Chunk);
+  left  = RAW(Left);
+  n     = (size_t) XLENGTH(Chunk);
+  nLeft = (size_t) XLENGTH(Left);
+  nTot  = nLeft + n;
+  nRem  = (Rf_asLogical(Final) ? 0 : nTot%3);  /* carried to the next chunk */
+  nEnc  = nTot - nRem;                         /* encoded now */
+  PROTECT(Out  = Rf_allocVector(RAWSXP, (R_xlen_t) ((nEnc+2)/3*4)));
+  PROTECT(Rest = Rf_allocVector(RAWSXP, (R_xlen_t) nRem));
+  for (i=0; i<nRem; i++) {  /* last nRem bytes of left+chunk */
+    size_t k = nEnc + i;
+    RAW(Rest)[i] = (k<nLeft ? left[k] : in[k-nLeft]);
+  }
+  if (nLeft && nEnc) {  /* complete the group started in previous chunk */
+    m = (nEnc<3 ? nEnc : 3) - nLeft;
+    memcpy(group, left, nLeft);
+    memcpy(group+nLeft, in, m);
+    j = b64_encode(group, nLeft+m, (char*) RAW(Out));
+    in   += m;
+    nEnc -= nLeft+m;
+  }
+  b64_encode(in, nEnc, (char*) RAW(Out)+j);
+  Ret = chunk_result(Out, Rest);
+  UNPROTECT(2);
+  return Ret;
+}
+
+SEXP b64decodechunk(SEXP Chunk, SEXP Left, SEXP Final)
+{
+  /* raw vector of Base64 characters -> list(decoded bytes, leftover
+   * characters); white space, like line breaks, is skipped */
+  size_t n, nLeft, nOut;
+  long j, m;
+  int i;
+  b64state s = {0, 0, 1};
+  SEXP Out, Rest, Ret;
+  if (TYPEOF(Chunk)!=RAWSXP || TYPEOF(Left)!=RAWSXP || XLENGTH(Left)>3)
+    Rf_error("base64decode: raw vector expected");
+  n     = (size_t) XLENGTH(Chunk);
+  nLeft = (size_t) XLENGTH(Left);
+  nOut  = (nLeft+n)/4*3 + 3;
+  PROTECT(Out = Rf_allocVector(RAWSXP, (R_xlen_t) nOut));
+  j = b64_decode(&s, (const char*) RAW(Left), nLeft, RAW(Out), nOut);
+  if (j>=0) {
+    m = b64_decode(&s, (const char*) RAW(Chunk), n, RAW(Out)+j, nOut-j);
+    j = (m<0 ? m : j+m);
+  }
+  if (j<0) Rf_error("base64decode: Input is not in Base64 format");
+  PROTECT(Rest = Rf_allocVector(RAWSXP, Rf_asLogical(Final) ? 0 : s.n));
+  for (i=0; i<XLENGTH(Rest); i++)  /* turn 6 bit values back into characters */
+    RAW(Rest)[i] = (Rbyte) B64Alphabet[(s.bits >> 6*(s.n-1-i)) & 63];
+  if (!XLENGTH(Rest)) j += b64_finish(&s, RAW(Out)+j);
+  if ((size_t) j<nOut) Out = Rf_xlengthgets(Out, (R_xlen_t) j);
+  PROTECT(Out);
+  Ret = chunk_result(Out, Rest);
+  UNPROTECT(3);
+  return Ret;
+}
@@ -0,0 +1,427 @@
+/*===========================================================================*/
+/* colAUC - Area Under ROC Curve of many features at once                    */
+/* Copyright (C) 2005 Jarek Tuszynski                                        */
+/* Distributed under GNU General Public License version 3                    */
+/*===========================================================================*/
+/*                                                                           */
+/* AUC of class a versus class b is the probability that a sample of class a */
+/* is bigger than a sample of class b, with ties counted as half:            */
+/*   AUC = sum over a-samples of (#b below it + #b equal to it / 2) / (na*nb)*/
+/* which is the same as the Wilcoxon rank sum statistic and as the area      */
+/* under the ROC curve integrated with trapz.                                */
+/*===========================================================================*/
+
+#include <R.h>
+#include <Rinternals.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+extern "C" {
+  #define Error Rf_error
+
+  typedef struct { double x; int y; } AucItem;   // value and its class
+
+  static bool AucLess(const AucItem &a, const AucItem &b) { return a.x < b.x; }
+
+  //----------------------------------------------------------------------
+  // Add a group of tied samples, with grp[a] samples of class a for each of
+  // nList classes in list, to S[a*nL+b]: sum, over samples of class a, of
+  // the number of class b samples smaller than it plus half of those equal
+  // to it. Groups are added in increasing order and cnt keeps cumulative
+  // count of each class. If E is given, E[a*nL+b] collects the tied pairs.
+  //----------------------------------------------------------------------
+  static void AucGroup(double *grp, const int *list, int nList, int nL,
+                       double *cnt, double *S, double *E)
+  {
+    int t, a, b;
+    for (t=0; t<nList; t++) {
+      a = list[t];
+      for (b=0; b<nL; b++) S[a*nL+b] += grp[a]*(cnt[b] + 0.5*grp[b]);
+      if (E) for (b=0; b<nL; b++) E[a*nL+b] += grp[a]*grp[b];
+    }
+    for (t=0; t<nList; t++) {
+      a = list[t];
+      cnt[a] += grp[a];
+      grp[a] = 0;
+    }
+  }
+
+  //----------------------------------------------------------------------
+  // Fill S for samples of a single column. Samples are sorted once and
+  // swept in groups of ties. Work done per group is proportional to the
+  // number of classes in it, so the sweep costs O(n*nL) and the sort
+  // O(n log n), for all class pairs.
+  //----------------------------------------------------------------------
+  static void AucCounts(AucItem *item, int n, int nL, double *cnt, double *grp,
+                        int *list, double *S)
+  {
+    int i, k, a, nList;
+    std::sort(item, item+n, AucLess);
+    memset(cnt, 0, nL*sizeof(double));
+    memset(grp, 0, nL*sizeof(double));
+    memset(S,   0, nL*nL*sizeof(double));
+    for (i=0; i<n; i=k) {
+      for (nList=0, k=i; k<n && item[k].x==item[i].x; k++) {
+        a = item[k].y;
+        if (!grp[a]++) list[nList++] = a;   // classes present in this group
+      }
+      AucGroup(grp, list, nList, nL, cnt, S, NULL);
+    }
+  }
+
+  SEXP colauc(SEXP X, SEXP Y, SEXP NL)
+  { // AUC of every column of X (without NA's) for every pair of classes
+    // in Y (1:nL, other values are skipped), with pairs in the same order
+    // as combs(1:nL, 2). Columns are done in parallel.
+    int nR = Rf_nrows(X), nC = Rf_ncols(X), nL = Rf_asInteger(NL), i, a, b;
+    int nP = nL*(nL-1)/2;
+    const double *x = REAL(X);
+    const int *y = INTEGER(Y);
+    if (Rf_length(Y)!=nR) Error("colAUC: length(y) and nrow(X) must be the same");
+    SEXP Ret;
+    PROTECT(Ret = Rf_allocMatrix(REALSXP, nP, nC));
+    double *auc = REAL(Ret);
+    double *nY  = (double*) R_alloc(nL, sizeof(double));
+    int    *cls = (int*)    R_alloc(nR, sizeof(int));
+    int m = 0;                                 // number of labeled samples
+    for (a=0; a<nL; a++) nY[a] = 0;
+    for (i=0; i<nR; i++) {
+      cls[i] = (y[i]>=1 && y[i]<=nL ? y[i]-1 : -1);
+      if (cls[i]>=0) { nY[cls[i]]++; m++; }
+    }
+    #pragma omp parallel private(i, a, b) if ((double) nR*nC > 10000)
+    {
+      AucItem *item = (AucItem*) malloc(m*sizeof(AucItem));
+      double  *work = (double*)  malloc((2*nL+nL*nL)*sizeof(double));
+      int     *list = (int*)     malloc(nL*sizeof(int));
+      double  *cnt = work, *grp = work+nL, *S = work+2*nL;
+      #pragma omp for schedule(dynamic, 16)
+      for (int j=0; j<nC; j++) {
+        const double *xj = x + (long long) j*nR;
+        int n = 0;
+        for (i=0; i<nR; i++) if (cls[i]>=0) {
+          item[n].x = xj[i];
+          item[n].y = cls[i];
+          n++;
+        }
+        AucCounts(item, n, nL, cnt, grp, list, S);
+        double *out = auc + (long long) j*nP;
+        for (a=0; a<nL; a++)
+          for (b=a+1; b<nL; b++)
+            *(out++) = (nY[a]>0 && nY[b]>0 ? S[a*nL+b]/(nY[a]*nY[b]) : 0.5);
+      }
+      free(item);
+      free(work);
+      free(list);
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+}
+
+//==============================================================================
+// Mergeable AUC accumulator. Each column is kept as a histogram: matrix with
+// sorted bucket keys in the first column and count of samples of each class
+// in the bucket in the others. Histograms of chunks of data are merged by
+// adding counts of equal keys. Keys are either the scores (exact AUC), or
+// indices of logarithmic buckets, each holding values within relative
+// accuracy alpha of each other (sketch of fixed size for any amount of data).
+//==============================================================================
+
+extern "C" {
+
+  typedef struct {
+    int    Sketch;       // 0 - exact, 1 - sketch
+    double Resolution;   // exact: scores are rounded to multiples of it (if >0)
+    double LogGamma;     // sketch: log of bucket width ratio (1+alpha)/(1-alpha)
+    double Shift;        // sketch: makes keys of all values >= DBL_MIN positive
+  } AucKeyParam;
+
+  static double AucKey(double x, const AucKeyParam *p)
+  { // monotone map from a score to its bucket key
+    if (!p->Sketch) return (p->Resolution>0 ? nearbyint(x/p->Resolution) : x);
+    double ax = fabs(x);
+    if (ax<DBL_MIN) return 0;
+    double k = ceil(log(ax)/p->LogGamma) + p->Shift;
+    return (x>0 ? k : -k);
+  }
+
+  SEXP aucbins(SEXP X, SEXP Y, SEXP NL, SEXP Param)
+  { // histograms of columns of X for classes in Y (1:nL, other values and
+    // NaN scores are skipped). Param: sketch, resolution, alpha
+    int nR = Rf_nrows(X), nC = Rf_ncols(X), nL = Rf_asInteger(NL), i, j;
+    const double *x = REAL(X), *param = REAL(Param);
+    const int *y = INTEGER(Y);
+    if (Rf_length(Y)!=nR) Error("aucAdd: length(y) and nrow(X) must be the same");
+    AucKeyParam kp;
+    kp.Sketch     = (param[0]!=0);
+    kp.Resolution = param[1];
+    kp.LogGamma   = log((1+param[2])/(1-param[2]));
+    kp.Shift      = ceil(-log(DBL_MIN)/kp.LogGamma) + 1;
+    if (kp.Sketch && !(param[2]>0 && param[2]<1)) Error("aucAccumulator: accuracy has to be in (0,1)");
+    double **hist = (double**) R_alloc(nC, sizeof(double*));
+    int     *nKey = (int*)     R_alloc(nC, sizeof(int));
+    #pragma omp parallel private(i) if ((double) nR*nC > 10000)
+    {
+      AucItem *item = (AucItem*) malloc(nR*sizeof(AucItem));
+      #pragma omp for schedule(dynamic, 16)
+      for (j=0; j<nC; j++) {
+        const double *xj = x + (long long) j*nR;
+        int n = 0, k = 0;
+        for (i=0; i<nR; i++) if (y[i]>=1 && y[i]<=nL && !ISNAN(xj[i])) {
+          item[n].x = AucKey(xj[i], &kp);
+          item[n].y = y[i]-1;
+          n++;
+        }
+        std::sort(item, item+n, AucLess);
+        for (i=0; i<n; i++) if (!i || item[i].x!=item[i-1].x) k++;
+        double *h = (double*) calloc((size_t) k*(nL+1)+1, sizeof(double));
+        nKey[j] = k;                         // [key, count of each class] matrix
+        for (i=0, k=-1; i<n; i++) {
+          if (!i || item[i].x!=item[i-1].x) h[++k] = item[i].x;
+          h[(long long) (item[i].y+1)*nKey[j] + k]++;
+        }
+        hist[j] = h;
+      }
+      free(item);
+    }
+    SEXP Ret, H;
+    PROTECT(Ret = Rf_allocVector(VECSXP, nC));
+    for (j=0; j<nC; j++) {
+      SET_VECTOR_ELT(Ret, j, H = Rf_allocMatrix(REALSXP, nKey[j], nL+1));
+      memcpy(REAL(H), hist[j], (size_t) nKey[j]*(nL+1)*sizeof(double));
+      free(hist[j]);
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+
+  static SEXP aucmerge1(SEXP A, SEXP B)
+  { // merge two histograms of the same column
+    int na = Rf_nrows(A), nb = Rf_nrows(B), nc = Rf_ncols(A), i, j, k, c;
+    const double *a = REAL(A), *b = REAL(B);
+    for (i=j=k=0; i<na || j<nb; k++) {  // count keys of the result
+      if      (j==nb || (i<na && a[i]<b[j])) i++;
+      else if (i==na || b[j]<a[i]) j++;
+      else { i++; j++; }
+    }
+    SEXP H = Rf_allocMatrix(REALSXP, k, nc);
+    double *h = REAL(H);
+    int nh = k;
+    for (i=j=k=0; i<na || j<nb; k++) {
+      if (j==nb || (i<na && a[i]<b[j])) {
+        for (c=0; c<nc; c++) h[c*nh+k] = a[c*na+i];
+        i++;
+      } else if (i==na || b[j]<a[i]) {
+        for (c=0; c<nc; c++) h[c*nh+k] = b[c*nb+j];
+        j++;
+      } else {
+        h[k] = a[i];
+        for (c=1; c<nc; c++) h[c*nh+k] = a[c*na+i] + b[c*nb+j];
+        i++; j++;
+      }
+    }
+    return H;
+  }
+
+  SEXP aucmerge(SEXP A, SEXP B)
+  { // merge lists of column histograms
+    int nC = Rf_length(A), j;
+    if (Rf_length(B)!=nC) Error("aucMerge: accumulators have different number of columns");
+    SEXP Ret;
+    PROTECT(Ret = Rf_allocVector(VECSXP, nC));
+    for (j=0; j<nC; j++) {
+      SEXP a = VECTOR_ELT(A, j), b = VECTOR_ELT(B, j);
+      if (Rf_ncols(a)!=Rf_ncols(b)) Error("aucMerge: accumulators have different classes");
+      SET_VECTOR_ELT(Ret, j, aucmerge1(a, b));
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+
+  SEXP aucvalue(SEXP Hist)
+  { // AUC of each column for every pair of classes, same as colauc, and the
+    // largest possible error of it: half of the pairs sharing a bucket.
+    // Columns are done in parallel.
+    int nC = Rf_length(Hist), nL = 0, j;
+    if (nC) nL = Rf_ncols(VECTOR_ELT(Hist, 0))-1;
+    int nP = nL*(nL-1)/2;
+    const double **hist = (const double**) R_alloc(nC, sizeof(double*));
+    int *nKey = (int*) R_alloc(nC, sizeof(int));
+    for (j=0; j<nC; j++) {
+      SEXP H = VECTOR_ELT(Hist, j);
+      if (Rf_ncols(H)!=nL+1) Error("aucResult: histograms have different classes");
+      hist[j] = REAL(H);
+      nKey[j] = Rf_nrows(H);
+    }
+    SEXP Ret, Auc, Err;
+    PROTECT(Ret = Rf_allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(Ret, 0, Auc = Rf_allocMatrix(REALSXP, nP, nC));
+    SET_VECTOR_ELT(Ret, 1, Err = Rf_allocMatrix(REALSXP, nP, nC));
+    double *auc = REAL(Auc), *err = REAL(Err);
+    #pragma omp parallel if (nC>16)
+    {
+      double *work = (double*) malloc((2*nL+2*nL*nL)*sizeof(double));
+      int    *list = (int*)    malloc(nL*sizeof(int));
+      double *cnt = work, *grp = work+nL, *S = work+2*nL, *E = S+nL*nL;
+      #pragma omp for schedule(dynamic, 16)
+      for (j=0; j<nC; j++) {
+        const double *h = hist[j];
+        int n = nKey[j], i, a, b, nList;
+        memset(work, 0, (2*nL+2*nL*nL)*sizeof(double));
+        for (i=0; i<n; i++) {               // a group for each key
+          for (nList=a=0; a<nL; a++)
+            if ((grp[a] = h[(long long) (a+1)*n+i])) list[nList++] = a;
+          AucGroup(grp, list, nList, nL, cnt, S, E);
+        }
+        double *out = auc + (long long) j*nP, *e = err + (long long) j*nP;
+        for (a=0; a<nL; a++)
+          for (b=a+1; b<nL; b++, out++, e++) {
+            double n2 = cnt[a]*cnt[b];
+            *out = (n2>0 ? S[a*nL+b]/n2 : 0.5);
+            *e   = (n2>0 ? 0.5*E[a*nL+b]/n2 : 0);
+          }
+      }
+      free(work);
+      free(list);
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+}
+
+//==============================================================================
+// ROC curves. Curve of class a versus class b goes through points
+// (fraction of a-samples, fraction of b-samples) below each threshold, from
+// (0,0) to (1,1). It changes direction only at scores where class a or b
+// samples are present, so a point is made only at those. AUC is integrated
+// with trapezoid rule along the way.
+// Curves can be downsampled to at most nPoint vertices: a point is kept
+// only if it is at least h = 2/(nPoint-2) away (in L1 distance) from the last
+// point kept. Each curve has L1 length 2, so at most nPoint points are kept,
+// and all skipped points are closer than h to the segment replacing them.
+//==============================================================================
+
+#include <vector>
+
+extern "C" {
+
+  typedef struct {
+    std::vector<double> x, y;   // vertices, in counts of samples
+    double lx, ly;              // last vertex seen
+    double Area;                // trapz area, in counts squared
+  } RocCurve;
+
+  static void RocPoint(RocCurve *c, double x, double y, double na, double nb,
+                       double h, bool last)
+  { // add point to the curve if it is far enough from the last one kept
+    c->Area += (x - c->lx)*(y + c->ly)/2;
+    c->lx = x;
+    c->ly = y;
+    size_t n = c->x.size();
+    double d = fabs(x - c->x[n-1])/na + fabs(y - c->y[n-1])/nb;
+    if (d>0 && (d>=h || last)) {
+      c->x.push_back(x);
+      c->y.push_back(y);
+    }
+  }
+
+  SEXP colroc(SEXP X, SEXP Y, SEXP NL, SEXP NPoint)
+  { // ROC curves and AUC of every column of X for every pair of classes
+    // in Y (1:nL, other values and NaN scores are skipped)
+    int nR = Rf_nrows(X), nC = Rf_ncols(X), nL = Rf_asInteger(NL), i, j;
+    int nP = nL*(nL-1)/2, nPoint = Rf_asInteger(NPoint);
+    const double *x = REAL(X);
+    const int *y = INTEGER(Y);
+    if (Rf_length(Y)!=nR) Error("colROC: length(y) and nrow(X) must be the same");
+    double h = (nPoint==NA_INTEGER || nPoint<=0 ? 0 : 2.0/((nPoint>3 ? nPoint : 3)-2));
+    int *pair = (int*) R_alloc(nL*nL, sizeof(int));   // index of class pair
+    for (int a=0, p=0; a<nL; a++)
+      for (int b=a+1; b<nL; b++, p++) pair[a*nL+b] = pair[b*nL+a] = p;
+    std::vector<RocCurve> roc((size_t) nC*nP);
+    #pragma omp parallel private(i) if ((double) nR*nC > 10000)
+    {
+      AucItem *item = (AucItem*) malloc(nR*sizeof(AucItem));
+      double  *cnt  = (double*)  malloc(3*nL*sizeof(double)), *grp = cnt+nL, *size = grp+nL;
+      int     *list = (int*)     malloc((nL+nP)*sizeof(int)), *stamp = list+nL;
+      #pragma omp for schedule(dynamic, 16)
+      for (j=0; j<nC; j++) {
+        const double *xj = x + (long long) j*nR;
+        RocCurve *c = &roc[(size_t) j*nP];
+        int n = 0, k, t, a, b, p, nList;
+        for (a=0; a<nL; a++) cnt[a] = grp[a] = size[a] = 0;
+        for (i=0; i<nR; i++) if (y[i]>=1 && y[i]<=nL && !ISNAN(xj[i])) {
+          item[n].x = xj[i];
+          item[n].y = y[i]-1;
+          size[y[i]-1]++;
+          n++;
+        }
+        for (p=0; p<nP; p++) {
+          c[p].x.push_back(0);
+          c[p].y.push_back(0);
+          c[p].lx = c[p].ly = c[p].Area = 0;
+          stamp[p] = -1;
+        }
+        std::sort(item, item+n, AucLess);
+        for (i=0; i<n; i=k) {
+          for (nList=0, k=i; k<n && item[k].x==item[i].x; k++) {
+            a = item[k].y;
+            if (!grp[a]++) list[nList++] = a;
+          }
+          for (t=0; t<nList; t++) cnt[list[t]] += grp[list[t]];
+          for (t=0; t<nList; t++) {       // curves with class a changed
+            a = list[t];
+            for (b=0; b<nL; b++) if (b!=a && stamp[p = pair[a*nL+b]]!=i) {
+              stamp[p] = i;
+              int a1 = (a<b ? a : b), b1 = (a<b ? b : a);
+              if (size[a1]>0 && size[b1]>0)
+                RocPoint(c+p, cnt[a1], cnt[b1], size[a1], size[b1], h, k==n);
+            }
+          }
+          for (t=0; t<nList; t++) grp[list[t]] = 0;
+        }
+        for (a=p=0; a<nL; a++)            // make sure all curves end at (1,1)
+          for (b=a+1; b<nL; b++, p++) {
+            size_t m = c[p].x.size();
+            if (!size[a] || !size[b]) {   // diagonal if a class is missing
+              c[p].x.push_back(1);
+              c[p].y.push_back(1);
+              c[p].Area = 0.5;
+            } else if (c[p].x[m-1]!=size[a] || c[p].y[m-1]!=size[b]) {
+              c[p].x.push_back(size[a]);
+              c[p].y.push_back(size[b]);
+            }
+          }
+      }
+      free(item);
+      free(cnt);
+      free(list);
+    }
+    SEXP Ret, Auc, Curves, Col, M;
+    PROTECT(Ret = Rf_allocVector(VECSXP, 2));
+    SET_VECTOR_ELT(Ret, 0, Auc    = Rf_allocMatrix(REALSXP, nP, nC));
+    SET_VECTOR_ELT(Ret, 1, Curves = Rf_allocVector(VECSXP, nC));
+    for (j=0; j<nC; j++) {
+      SET_VECTOR_ELT(Curves, j, Col = Rf_allocVector(VECSXP, nP));
+      for (int p=0; p<nP; p++) {
+        RocCurve *c = &roc[(size_t) j*nP+p];
+        int m = (int) c->x.size();
+        double nx = c->x[m-1], ny = c->y[m-1], *xy;
+        REAL(Auc)[(long long) j*nP+p] = c->Area/(nx*ny);
+        SET_VECTOR_ELT(Col, p, M = Rf_allocMatrix(REALSXP, m, 2));
+        xy = REAL(M);
+        for (i=0; i<m; i++) {
+          xy[i]   = c->x[i]/nx;
+          xy[m+i] = c->y[i]/ny;
+        }
+        std::vector<double>().swap(c->x);   // free memory as we go
+        std::vector<double>().swap(c->y);
+      }
+    }
+    UNPROTECT(1);
+    return Ret;
+  }
+}